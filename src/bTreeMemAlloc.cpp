@@ -15,10 +15,34 @@
 #include <atomic>
 #include <cstdint>
 #include <unordered_set>
+#include <unordered_map>
+#include <map>
+#include <deque>
+#include <numeric>
+#include <cstdio>
 #include <unistd.h>     
 #include <sys/ioctl.h>  
 #include <termios.h>
 #include <string>
+#include <string_view>
+#include <cstring>
+#include <compare>
+#include <stdexcept>
+#include <concepts>
+#include <charconv>
+#include <memory>
+#include <iterator>
+#include <type_traits>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <bit>
+#include <limits>
+#include <optional>
+#include <condition_variable>
+#include <functional>
+#include <exception>
 
 #define RESET       "\033[0m"
 #define RED         "\033[31m"
@@ -44,6 +68,7 @@ public:
     static SubAllocator& instance();
     void* allocate();
     void deallocate(void* ptr);
+    void deallocate(const std::vector<void*>& blocks);
 
 private:
     alignas(Block) uint8_t initial_memory_[BLOCK_SIZE * INITIAL_BLOCK_COUNT];
@@ -63,14 +88,313 @@ private:
     void expand_pool();
 };
 
+template <std::size_t N>
+class InlineString {
+public:
+    static constexpr std::size_t CAPACITY = N;
+    static_assert(N > 0 && N <= UINT8_MAX, "InlineString capacity must fit into one length byte");
+
+    InlineString();
+    explicit InlineString(std::string_view text);
+    explicit InlineString(const char* text);
+    explicit InlineString(const std::string& text);
+
+    std::string_view view() const;
+    std::size_t size() const;
+
+    bool operator==(const InlineString& other) const;
+    std::strong_ordering operator<=>(const InlineString& other) const;
+    bool operator==(std::string_view other) const;
+    std::strong_ordering operator<=>(std::string_view other) const;
+
+private:
+    uint8_t length_;
+    char data_[N];
+};
+
+template <std::size_t N>
+std::ostream& operator<<(std::ostream& os, const InlineString<N>& key);
+
+template <typename K, typename T>
+concept KeyComparableWith = requires(const K& key, const T& stored) {
+    { key < stored } -> std::convertible_to<bool>;
+    { stored < key } -> std::convertible_to<bool>;
+    { key == stored } -> std::convertible_to<bool>;
+};
+
+template <typename T>
+concept CodecKey = std::is_trivially_copyable_v<T> || std::same_as<T, std::string>;
+
+template <typename T>
+struct KeyCodec {
+    static_assert(std::is_trivially_copyable_v<T>, "KeyCodec needs a trivially copyable key or a specialization");
+    static constexpr uint32_t KEY_SIZE = sizeof(T);
+
+    static void encode(const T* keys, std::size_t count, std::vector<char>& out);
+    static std::size_t decode(const char* data, std::size_t available, std::size_t count, std::vector<T>& out);
+};
+
+template <>
+struct KeyCodec<std::string> {
+    static constexpr uint32_t KEY_SIZE = 0;
+
+    static void encode(const std::string* keys, std::size_t count, std::vector<char>& out);
+    static std::size_t decode(const char* data, std::size_t available, std::size_t count, std::vector<std::string>& out);
+};
+
+uint64_t snapshotChecksum(const char* data, std::size_t size);
+uint64_t mixHash(uint64_t value);
+void writeAll(int fd, const char* data, std::size_t size);
+bool readAll(int fd, char* data, std::size_t size);
+bool syncDirectoryOf(const std::string& path);
+
+template <typename T>
+class WriteAheadLog {
+public:
+    static constexpr uint64_t MAGIC = 0x31474f4c45455254ULL;
+    static constexpr uint32_t VERSION = 2;
+
+    enum class Operation : uint8_t {
+        Insert = 1,
+        Remove = 2,
+        Update = 3
+    };
+
+    explicit WriteAheadLog(const std::string& path);
+    ~WriteAheadLog();
+
+    uint64_t append(Operation op, const T& key);
+    uint64_t lastLsn() const;
+    void waitDurable(uint64_t lsn);
+    template <typename F>
+    std::size_t replay(F&& apply, uint64_t afterLsn = 0);
+    void truncate(uint64_t throughLsn);
+    uint64_t batchCount() const;
+
+private:
+    struct FileHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t keySize;
+    };
+
+    struct RecordHeader {
+        uint32_t length;
+        uint32_t reserved;
+        uint64_t checksum;
+    };
+
+    std::string path_;
+    int fd_;
+    mutable std::mutex mutex_;
+    std::condition_variable flushed_;
+    std::vector<char> pending_;
+    uint64_t nextLsn_;
+    uint64_t durableLsn_;
+    uint64_t batches_;
+    bool flushing_;
+    bool failed_;
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    std::vector<char> readRecords() const;
+};
+
+template <typename T>
+concept HashableKey = requires(const T& key) {
+    { std::hash<T>{}(key) } -> std::convertible_to<std::size_t>;
+};
+
+template <typename T>
+class KeyFilter {
+public:
+    static constexpr std::size_t MIN_CAPACITY = 1024;
+    static constexpr std::size_t COUNTERS_PER_KEY = 12;
+    static constexpr std::size_t CHECK_INTERVAL = 4096;
+    static constexpr int PROBES = 4;
+
+    explicit KeyFilter(std::size_t capacity);
+
+    bool mayContain(const T& key) const;
+    void add(const T& key);
+    void remove(const T& key);
+    void recordNegative();
+    void recordFalsePositive();
+    bool degraded() const;
+    std::size_t capacity() const;
+
+private:
+    static constexpr std::size_t WORDS_PER_BLOCK = 8;
+    static constexpr std::size_t COUNTERS_PER_WORD = 16;
+
+    struct alignas(64) Block {
+        std::array<std::atomic<uint64_t>, WORDS_PER_BLOCK> words{};
+    };
+
+    std::unique_ptr<Block[]> blocks;
+    std::size_t blockCount;
+    std::size_t capacity_;
+    std::atomic<std::size_t> keys;
+    mutable std::atomic<std::size_t> negatives;
+    mutable std::atomic<std::size_t> falsePositives;
+
+    template <typename F>
+    void forEachCounter(const T& key, F&& fn) const;
+};
+
+template <typename T>
+concept CacheableKey = HashableKey<T> && std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>;
+
+enum class LockMode {
+    Shared,
+    ReaderBiased
+};
+
+class ReaderBiasedMutex {
+public:
+    static constexpr std::size_t READER_SLOTS = 1024;
+    static constexpr std::size_t MAX_HELD = 8;
+    static constexpr int64_t INHIBIT_MULTIPLIER = 9;
+
+    explicit ReaderBiasedMutex(LockMode mode = LockMode::Shared);
+
+    void lock();
+    bool try_lock();
+    void unlock();
+    void lock_shared();
+    bool try_lock_shared();
+    void unlock_shared();
+
+private:
+    struct alignas(64) ReaderSlot {
+        std::atomic<const ReaderBiasedMutex*> owner{nullptr};
+    };
+
+    struct HeldSlots {
+        std::array<const ReaderBiasedMutex*, MAX_HELD> locks;
+        std::array<std::size_t, MAX_HELD> slots;
+        std::size_t count = 0;
+    };
+
+    static std::array<ReaderSlot, READER_SLOTS> readerSlots;
+    std::shared_mutex mutex_;
+    const bool biasable_;
+    std::atomic<bool> readBias_;
+    std::atomic<int64_t> inhibitUntil_;
+
+    ReaderBiasedMutex(const ReaderBiasedMutex&) = delete;
+    ReaderBiasedMutex& operator=(const ReaderBiasedMutex&) = delete;
+
+    static HeldSlots& heldSlots();
+    static int64_t now();
+    bool tryFastShared();
+    void afterSlowShared();
+    void revokeBias();
+};
+
+class WorkStealingPool {
+public:
+    static WorkStealingPool& instance();
+    std::size_t concurrency() const;
+    void run(std::size_t taskCount, const std::function<void(std::size_t)>& task);
+
+private:
+    struct Job {
+        const std::function<void(std::size_t)>& task;
+        std::atomic<std::size_t> pending;
+        std::mutex errorMutex;
+        std::exception_ptr error;
+    };
+
+    struct Task {
+        Job* job;
+        std::size_t index;
+    };
+
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<std::size_t> queued_;
+    bool stopping_;
+
+    WorkStealingPool();
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    static std::size_t& workerIndex();
+    bool runOne(std::size_t home, bool owner);
+    void workerLoop(std::size_t index);
+};
+
+template <typename Tree>
+class BTreeAlgorithms {
+public:
+    template <typename Ref, typename K>
+    static std::size_t findKey(const Tree& tree, Ref node, const K& key);
+    template <typename Ref, typename K>
+    static std::size_t findInsertPos(const Tree& tree, Ref node, const K& key);
+    template <typename Ref, typename K>
+    static Ref find(const Tree& tree, Ref node, const K& key, std::size_t& pos);
+    template <typename Path, typename Ref>
+    static void splitUpward(Tree& tree, Path& path, Ref node, Ref& top);
+    template <typename Ref>
+    static void fill(Tree& tree, Ref parent, int index);
+    template <typename Path, typename Ref>
+    static void rebalanceUpward(Tree& tree, Path& path, Ref node);
+};
+
+template <typename T>
+class Checkpointer;
+
+template <typename T>
+class PackedIndex;
+
+template <typename T>
+class FrozenIndex;
+
 template <typename T>
 class BTree {
 private:
-    int t;
-    mutable std::shared_mutex tree_mutex;
+    static constexpr int MAX_HEIGHT = 64;
+    static constexpr uint64_t SNAPSHOT_MAGIC = 0x31504e5345455254ULL;
+    static constexpr uint32_t SNAPSHOT_VERSION = 1;
+    static constexpr std::size_t SNAPSHOT_CHUNK_SIZE = std::size_t(1) << 20;
+    static constexpr std::size_t CACHE_SLOTS = 256;
+    static constexpr int APPEND_STREAK = 4;
+    static constexpr std::size_t MULTI_SEARCH_LOOKAHEAD = 8;
+    static constexpr std::size_t COMPACT_BATCH = 64;
+
+    struct SnapshotHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t keySize;
+        uint64_t keyCount;
+        uint64_t checksum;
+    };
+
+    struct SnapshotChunk {
+        uint32_t byteCount;
+        uint32_t keyCount;
+        uint64_t checksum;
+    };
+
+    std::size_t t;
+    mutable ReaderBiasedMutex tree_mutex;
+    WriteAheadLog<T>* wal;
     
     struct Node {
         bool isLeaf;
+        uint32_t dirtyEpoch;
+        std::size_t count;
         std::vector<T> keys;
         std::vector<Node*> children;
         
@@ -81,31 +405,571 @@ private:
         static void operator delete(void* ptr, std::size_t size);        
     };
     
+    struct PathEntry {
+        Node* node;
+        int index;
+    };
+
+    struct Path {
+        std::array<PathEntry, MAX_HEIGHT> entries;
+        int depth = 0;
+
+        void push(Node* node, int index);
+        PathEntry pop();
+        bool empty() const;
+    };
+    
+    struct EdgeHint {
+        Path path;
+        uint64_t epoch = std::numeric_limits<uint64_t>::max();
+    };
+    
+    struct Partition {
+        Node* subtree;
+        const T* separator;
+    };
+    
     Node* root;
+    uint64_t shapeEpoch;
+    EdgeHint leftHint;
+    EdgeHint rightHint;
+    int appendStreak;
+    bool appending;
+    bool spineUnderfull;
+    uint32_t checkpointEpoch;
+    std::unordered_set<Node*> dirtyNodes;
+    std::atomic<std::shared_ptr<KeyFilter<T>>> filter;
+    std::atomic<bool> filterInstalled;
+    mutable std::atomic<bool> filterStale;
+    
+    struct CacheSlot {
+        uint64_t tree;
+        uint64_t version;
+        T key;
+        bool found;
+    };
+    
+    inline static std::atomic<uint64_t> nextTreeId{1};
+    const uint64_t treeId;
+    std::atomic<uint64_t> version;
+    std::atomic<bool> cacheEnabled;
+    
+    bool lazyDelete;
+    bool redistributeOnSplit;
+    std::vector<T> underfullKeys;
     
+    friend class Checkpointer<T>;
+    friend class PackedIndex<T>;
+    friend class BTreeAlgorithms<BTree>;
+    
+    std::size_t keyCount(Node* node) const;
+    const T& keyAt(Node* node, std::size_t index) const;
+    Node* childAt(Node* node, std::size_t index) const;
+    bool isLeaf(Node* node) const;
+    std::size_t maxKeys() const;
+    std::size_t minKeys() const;
+    Node* growRoot(Node* node);
+    bool absorbOverflow(Node* parent, int index);
     void splitChild(Node* parent, int index);
-    void insertNonFull(Node* node, const T& key);
-    bool search(Node* node, const T& key, int& pos) const;
-    T getPredecessor(Node* node, int index);
-    T getSuccessor(Node* node, int index);
+    void splitChild(Node* parent, int index, std::size_t mid);
+    Path& edgePath(EdgeHint& hint, bool rightmost);
+    void endAppendRun();
+    const Node* edgeLeaf(const EdgeHint& hint, bool rightmost) const;
+    std::optional<T> popEdge(bool rightmost);
+    bool shiftToSibling(Node* parent, int index);
+    void splitThree(Node* parent, int index);
+    void splitUpward(Path& path, Node* node, Node*& top);
+    template <typename U>
+    void insert(Node* node, U&& key);
+    template <typename U, typename F>
+    bool insertUnique(Node* node, U&& key, F&& onExisting);
+    template <typename U>
+    void insertAt(Path& path, Node* leaf, int pos, U&& key);
     void mergeNodes(Node* node, int index);
     void borrowFromPrev(Node* node, int index);
     void borrowFromNext(Node* node, int index);
     void fill(Node* node, int index);
-    void removeFromLeaf(Node* node, int index);
-    void removeFromNonLeaf(Node* node, int index);
-    int findKey(Node* node, const T& key);
-    void remove(Node* node, const T& key);
+    void rebalanceUpward(Path& path, Node* node);
+    void settleRemoval(Path& path, Node* node);
+    void repairUpward(Path& path);
+    bool findUnderfullLeaf(Node* node, const T& key, Path& path);
+    void settleLeaf(const T& key);
+    std::size_t settleUnderfull(std::size_t limit);
+    template <typename K>
+    std::size_t findKey(Node* node, const K& key) const;
+    template <typename K>
+    std::size_t findInsertPos(Node* node, const K& key) const;
+    template <typename K>
+    bool remove(Node* node, const K& key);
+    template <typename K, typename F>
+    bool remove(Node* node, const K& key, F&& shouldErase);
+    template <typename K>
+    std::size_t rank(Node* node, const K& key, bool inclusive) const;
+    template <typename F>
+    void forEachRun(Node* node, F&& fn) const;
+    std::vector<Partition> partition(std::size_t target) const;
+    Node* buildFromSorted(std::vector<T>& keys, std::size_t begin, std::size_t end,
+                          const std::vector<std::size_t>& capacity, int height, bool isRoot);
+    Node* buildFromSorted(std::vector<T>& keys);
+    void onInserted(const T& key);
+    void onRemoved(const T& key);
+    void onUpdated(const T& key);
+    void waitForLog(std::unique_lock<ReaderBiasedMutex>& lock);
+    void markDirty(Node* node);
+    void dropDirty(Node* node);
+    void markAllDirty();
+    void collapseRoot();
+    void rebuildFilter();
+    void onReplaced();
+    template <typename K>
+    const T* locate(const K& key) const;
+    int height(Node* node) const;
+    void recount(Node* node);
+    void repairChild(Node* parent, int index);
+    Node* trimRoot(Node* node);
+    Node* joinNodes(Node* left, T&& separator, Node* right);
+    Node* concatNodes(Node* left, Node* right);
+    template <typename K>
+    std::pair<Node*, Node*> splitNodes(Node* node, const K& key, bool inclusive);
+    void releaseNodes(Node* node);
+    void adoptNodes(Node* piece, BTree& from);
+    static const T& edgeKey(Node* node, bool rightmost);
+    static std::array<CacheSlot, CACHE_SLOTS>& lookupCache();
     void traverse(Node* node) const;
     
 public:
-    BTree(int degree);
+    struct Stats {
+        std::size_t keys;
+        std::size_t nodes;
+        int height;
+        double utilization;
+        std::size_t underfull;
+    };
+    
+    BTree(int degree, LockMode locking = LockMode::Shared);
     ~BTree();
     
     void traverse() const;
+    template <typename K = T> requires KeyComparableWith<K, T>
+    bool search(const K& key) const;
+    void insert(const T& key);
+    void insert(T&& key);
+    template <typename... Args>
+    void emplace(Args&&... args);
+    template <typename K = T> requires KeyComparableWith<K, T>
+    void remove(const K& key);
+    bool insert_if_absent(const T& key);
+    bool insert_if_absent(T&& key);
+    template <typename K = T> requires KeyComparableWith<K, T>
+    bool erase(const K& key);
+    template <typename F>
+    bool upsert(const T& key, F&& update);
+    template <typename K, typename F> requires KeyComparableWith<K, T>
+    bool update_or_erase(const K& key, F&& update);
+    template <typename K = T> requires KeyComparableWith<K, T>
+    std::optional<T> find(const K& key) const;
+    template <typename K = T> requires KeyComparableWith<K, T>
+    void multiSearch(const std::vector<K>& keys, std::vector<bool>& found) const;
+    
+    std::size_t size() const;
+    template <typename K = T> requires KeyComparableWith<K, T>
+    std::size_t rank(const K& key) const;
+    T select(std::size_t k) const;
+    std::optional<T> min() const;
+    std::optional<T> max() const;
+    std::optional<T> pop_min();
+    std::optional<T> pop_max();
+    template <typename K = T> requires KeyComparableWith<K, T>
+    std::size_t countRange(const K& lo, const K& hi) const;
+    template <typename K = T> requires KeyComparableWith<K, T>
+    std::size_t removeRange(const K& lo, const K& hi);
+    template <typename K = T> requires KeyComparableWith<K, T>
+    void split(const K& key, BTree& other);
+    void join(BTree& other);
+    template <typename F>
+    void parallel_for_each(F&& fn) const;
+    template <typename R, typename Accumulate, typename Combine>
+    R parallel_reduce(R identity, Accumulate&& accumulate, Combine&& combine) const;
+    FrozenIndex<T> freeze() const;
+    std::size_t memoryUsage() const;
+    Stats stats() const;
+    
+    void save(int fd) const;
+    void load(int fd);
+    
+    void attachLog(WriteAheadLog<T>* log);
+    std::size_t recover(WriteAheadLog<T>& log, uint64_t afterLsn = 0);
+    
+    void enableFilter();
+    void disableFilter();
+    std::size_t filterCapacity() const;
+    
+    void enableLookupCache();
+    void disableLookupCache();
+    
+    void enableLazyDelete();
+    void disableLazyDelete();
+    bool lazyDeleteEnabled() const;
+    std::size_t compact();
+    std::size_t pendingRebalances() const;
+    
+    void enableRedistribution();
+    void disableRedistribution();
+};
+
+template <typename T>
+class Checkpointer {
+public:
+    static constexpr uint64_t MAGIC = 0x31544e494f504b43ULL;
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint64_t COMPACTION_SLACK = uint64_t(1) << 16;
+    static constexpr std::size_t CHECKPOINT_BATCH = 256;
+
+    Checkpointer(BTree<T>& tree, const std::string& path, WriteAheadLog<T>* log = nullptr,
+                 std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+    ~Checkpointer();
+
+    std::size_t checkpoint();
+    uint64_t fileSize() const;
+
+private:
+    using Node = typename BTree<T>::Node;
+
+    enum RecordKind : uint32_t {
+        LeafRecord = 1,
+        InnerRecord = 2,
+        CommitRecord = 3
+    };
+
+    struct FileHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t keySize;
+    };
+
+    struct RecordHeader {
+        uint32_t kind;
+        uint32_t keyCount;
+        uint64_t id;
+        uint64_t byteCount;
+        uint64_t checksum;
+    };
+
+    struct Image {
+        std::unordered_map<uint64_t, std::size_t> nodes;
+        uint64_t root = 0;
+        uint64_t lsn = 0;
+        std::size_t end = sizeof(FileHeader);
+        bool committed = false;
+    };
+
+    BTree<T>& tree_;
+    std::string path_;
+    WriteAheadLog<T>* log_;
+    std::chrono::milliseconds interval_;
+    int fd_;
+    uint64_t fileBytes_;
+    uint64_t liveBytes_;
+    uint64_t lastRoot_;
+    mutable std::mutex mutex_;
+    std::mutex stateMutex_;
+    std::condition_variable wake_;
+    bool stopping_;
+    std::thread worker_;
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    void run();
+    void restore();
+    void compact();
+    std::vector<char> readFile() const;
+    Image parse(const std::vector<char>& data) const;
+    Node* restoreNode(const std::vector<char>& data, const Image& image, uint64_t id, int depth) const;
+    void appendNode(std::vector<char>& out, const Node* node) const;
+    static void sealRecord(std::vector<char>& out, std::size_t start, uint32_t kind, uint32_t keyCount, uint64_t id);
+    static uint64_t recordChecksum(const RecordHeader& record, const char* payload);
+};
+
+template <typename T>
+class NodeCompactor {
+public:
+    NodeCompactor(BTree<T>& tree, std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+    ~NodeCompactor();
+
+private:
+    BTree<T>& tree_;
+    std::chrono::milliseconds interval_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_;
+    bool ownsLazyDelete_;
+    std::thread worker_;
+
+    NodeCompactor(const NodeCompactor&) = delete;
+    NodeCompactor& operator=(const NodeCompactor&) = delete;
+
+    void run();
+};
+
+template <typename T>
+class PackedIndex {
+    static_assert(std::is_integral_v<T>, "PackedIndex packs integer keys only");
+
+public:
+    static constexpr std::size_t BLOCK_KEYS = 128;
+
+    PackedIndex() = default;
+    explicit PackedIndex(const BTree<T>& tree);
+
+    bool search(T key) const;
+    void insert(T key);
+    bool remove(T key);
+    std::size_t size() const;
+    std::size_t memoryUsage() const;
+
+private:
+    using Delta = std::make_unsigned_t<T>;
+
+    struct Block {
+        T base;
+        uint16_t count;
+        uint8_t bits;
+        std::vector<uint64_t> words;
+    };
+
+    mutable std::shared_mutex index_mutex;
+    std::vector<Block> blocks;
+    std::size_t keyCount = 0;
+
+    static Block pack(const T* keys, std::size_t count);
+    static void unpack(const Block& block, T* out);
+    static Delta extract(const Block& block, std::size_t i);
+    std::size_t findBlock(T key) const;
+    void append(const T* keys, std::size_t count);
+};
+
+template <typename T>
+class FrozenIndex {
+public:
+    FrozenIndex() = default;
+    explicit FrozenIndex(std::vector<T> sorted);
+
+    template <typename K = T> requires KeyComparableWith<K, T>
+    bool contains(const K& key) const;
+    template <typename K = T> requires KeyComparableWith<K, T>
+    void contains(const std::vector<K>& keys, std::vector<bool>& found) const;
+    template <typename K = T> requires KeyComparableWith<K, T>
+    const T* lowerBound(const K& key) const;
+    std::size_t size() const;
+    std::size_t memoryUsage() const;
+
+private:
+    static constexpr std::size_t BATCH = 16;
+    static constexpr std::size_t PREFETCH_STRIDE = sizeof(T) >= 64 ? 1 : 64 / sizeof(T);
+
+    std::vector<T> layout;
+
+    template <typename K>
+    std::size_t descend(const K& key) const;
+    static void placeInOrder(std::vector<std::size_t>& source, std::size_t node, std::size_t& next);
+};
+
+template <typename T>
+struct CountedKey {
+    T key;
+    uint64_t count;
+
+    bool operator==(const CountedKey& other) const { return key == other.key; }
+    auto operator<=>(const CountedKey& other) const { return key <=> other.key; }
+    bool operator==(const T& other) const { return key == other; }
+    auto operator<=>(const T& other) const { return key <=> other; }
+};
+
+template <typename T>
+class CountedMultiset {
+public:
+    explicit CountedMultiset(int degree);
+
+    void insert(const T& key);
+    bool remove(const T& key);
     bool search(const T& key) const;
+    std::size_t count(const T& key) const;
+    std::size_t size() const;
+    std::size_t distinct() const;
+
+private:
+    BTree<CountedKey<T>> tree;
+    std::atomic<std::size_t> total;
+};
+
+class MappedPool {
+public:
+    static constexpr std::size_t PAGE_SIZE = 4096;
+    static constexpr std::size_t EXPANSION_PAGE_COUNT = 1024;
+    static constexpr std::size_t MAX_MAPPING_SIZE = std::size_t(1) << 36;
+    static constexpr uint64_t MAGIC = 0x315845444e494254ULL;
+    static constexpr uint32_t VERSION = 1;
+    static constexpr std::size_t MIN_CACHE_PAGES = 64;
+    static constexpr std::size_t PREFETCH_QUEUE_LIMIT = 256;
+
+    struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t pageSize;
+        uint32_t keySize;
+        uint32_t degree;
+        uint64_t root;
+        uint64_t freeHead;
+        uint64_t pageCount;
+        uint64_t keyCount;
+    };
+
+    class PinScope {
+    public:
+        PinScope(const MappedPool& pool, bool writable);
+        ~PinScope();
+
+    private:
+        const MappedPool& pool_;
+        bool writable_;
+        std::size_t mark_;
+
+        PinScope(const PinScope&) = delete;
+        PinScope& operator=(const PinScope&) = delete;
+    };
+
+    MappedPool(const std::string& path, uint32_t keySize, std::size_t cachePages = 0);
+    ~MappedPool();
+
+    bool created() const;
+    Header& header() const;
+    void* at(uint64_t offset) const;
+    void prefetch(uint64_t offset) const;
+    uint64_t allocate();
+    void deallocate(uint64_t offset);
+    void sync();
+    std::size_t cacheMisses() const;
+
+private:
+    struct Frame {
+        uint64_t page = 0;
+        int pins = 0;
+        bool referenced = false;
+        bool dirty = false;
+        bool loading = false;
+    };
+
+    int fd_;
+    uint8_t* base_;
+    bool created_;
+
+    mutable Header header_;
+    mutable std::mutex buffer_mutex_;
+    mutable std::condition_variable loaded_;
+    mutable std::vector<Frame> frames_;
+    mutable std::vector<uint64_t> frame_data_;
+    mutable std::unordered_map<uint64_t, std::size_t> frame_of_;
+    mutable std::size_t clock_hand_;
+    mutable std::size_t misses_;
+    mutable std::deque<uint64_t> prefetch_queue_;
+    mutable std::condition_variable prefetch_wake_;
+    bool stopping_;
+    std::thread prefetcher_;
+
+    MappedPool(const MappedPool&) = delete;
+    MappedPool& operator=(const MappedPool&) = delete;
+
+    static std::vector<std::pair<const MappedPool*, std::size_t>>& pinned_frames();
+    bool buffered() const;
+    uint8_t* frame_bytes(std::size_t frame) const;
+    void* pin(uint64_t offset, bool record) const;
+    std::size_t evict() const;
+    void write_frame(std::size_t frame) const;
+    void run_prefetcher();
+    void expand_pool();
+};
+
+template <typename T>
+class MappedBTree {
+private:
+    static_assert(std::is_trivially_copyable_v<T>, "MappedBTree keys are stored in the file as raw bytes");
+    static_assert(alignof(T) <= alignof(uint64_t), "MappedBTree keys must not need more than 8-byte alignment");
+
+    static constexpr int MAX_HEIGHT = 64;
+    static constexpr int MAX_KEYS = static_cast<int>((MappedPool::PAGE_SIZE - 2 * sizeof(uint64_t)) / (sizeof(T) + sizeof(uint64_t)));
+    static_assert(MAX_KEYS >= 4, "MappedBTree key type is too large for one page");
+
+    struct Page {
+        uint32_t count;
+        uint32_t isLeaf;
+        T keys[MAX_KEYS];
+        uint64_t children[MAX_KEYS + 1];
+    };
+    static_assert(sizeof(Page) <= MappedPool::PAGE_SIZE, "MappedBTree page does not fit into a pool page");
+
+    struct PathEntry {
+        uint64_t node;
+        int index;
+    };
+
+    struct Path {
+        std::array<PathEntry, MAX_HEIGHT> entries;
+        int depth = 0;
+
+        void push(uint64_t node, int index);
+        PathEntry pop();
+        bool empty() const;
+    };
+
+    static constexpr int SCAN_PREFETCH = 4;
+
+    uint32_t t;
+    mutable std::shared_mutex tree_mutex;
+    MappedPool pool;
+
+    friend class BTreeAlgorithms<MappedBTree>;
+
+    Page* page(uint64_t offset) const;
+    uint64_t newPage(bool leaf);
+    std::size_t keyCount(uint64_t node) const;
+    uint64_t childAt(uint64_t node, std::size_t index) const;
+    bool isLeaf(const Page* node) const;
+    std::size_t maxKeys() const;
+    std::size_t minKeys() const;
+    std::size_t keyCount(const Page* node) const;
+    const T& keyAt(const Page* node, std::size_t index) const;
+    const Page* childAt(const Page* node, std::size_t index) const;
+    uint64_t growRoot(uint64_t node);
+    bool absorbOverflow(uint64_t parent, int index);
+    template <typename K>
+    std::size_t findKey(const Page* node, const K& key) const;
+    template <typename K>
+    std::size_t findInsertPos(const Page* node, const K& key) const;
+    void insertAt(Page* node, int index, const T& key, uint64_t rightChild);
+    void eraseAt(Page* node, int index, int childIndex);
+    void splitChild(uint64_t parent, int index);
+    void splitUpward(Path& path, uint64_t node);
+    void mergeNodes(uint64_t parent, int index);
+    void borrowFromPrev(uint64_t parent, int index);
+    void borrowFromNext(uint64_t parent, int index);
+    void fill(uint64_t parent, int index);
+    void rebalanceUpward(Path& path, uint64_t node);
+
+public:
+    explicit MappedBTree(const std::string& path, int degree = 0, std::size_t cachePages = 0);
+    ~MappedBTree();
+
+    template <typename K = T> requires KeyComparableWith<K, T>
+    bool search(const K& key) const;
     void insert(const T& key);
-    void remove(const T& key);
+    template <typename K = T> requires KeyComparableWith<K, T>
+    void remove(const K& key);
+    template <typename F>
+    void forEach(F&& fn) const;
+    std::size_t size() const;
+    std::size_t cacheMisses() const;
+    void sync();
 };
     
 void testBasicOperations();
@@ -118,6 +982,28 @@ void testAlternatingInsertRemove();
 void testConcurrencyMixed();
 void testHeavyConcurrency();
 void testHeavyConcurrencyString();
+void testInlineStringKeys();
+void testMoveOnlyKeys();
+void testMappedPersistence();
+void testSnapshotSaveLoad();
+void testWriteAheadLog();
+void testIncrementalCheckpoint();
+void testPackedIndex();
+void testConditionalOperations();
+void testCountedMultiset();
+void testKeyFilter();
+void testLookupCache();
+void testLazyDelete();
+void testRangeRemoval();
+void testSplitJoin();
+void testReadScaling();
+void testFrozenIndex();
+void testRedistribution();
+void testAppendInserts();
+void testPriorityQueue();
+void testBufferPool();
+void testParallelTraversal();
+void testMultiSearch();
 void showMenu();
 void runAllTests();
 int getTerminalWidth();
@@ -151,6 +1037,50 @@ int main() {
             case '9': runSingleTest(testHeavyConcurrency, "Финальный стресс-тест"); break;
             case 's': 
             case 'S': runSingleTest(testHeavyConcurrencyString, "Финальный стресс-тест (строки)"); break;
+            case 'a':
+            case 'A': runSingleTest(testInlineStringKeys, "Строковые ключи фиксированной длины"); break;
+            case 'b':
+            case 'B': runSingleTest(testMoveOnlyKeys, "Перемещаемые ключи без копирования"); break;
+            case 'c':
+            case 'C': runSingleTest(testMappedPersistence, "Индекс в отображаемом файле"); break;
+            case 'd':
+            case 'D': runSingleTest(testSnapshotSaveLoad, "Сохранение и загрузка снимка"); break;
+            case 'e':
+            case 'E': runSingleTest(testWriteAheadLog, "Журнал упреждающей записи"); break;
+            case 'f':
+            case 'F': runSingleTest(testIncrementalCheckpoint, "Инкрементальные контрольные точки"); break;
+            case 'g':
+            case 'G': runSingleTest(testPackedIndex, "Сжатый индекс целых ключей"); break;
+            case 'h':
+            case 'H': runSingleTest(testConditionalOperations, "Условные операции за один спуск"); break;
+            case 'i':
+            case 'I': runSingleTest(testCountedMultiset, "Мультимножество со счётчиками"); break;
+            case 'j':
+            case 'J': runSingleTest(testKeyFilter, "Фильтр Блума перед деревом"); break;
+            case 'k':
+            case 'K': runSingleTest(testLookupCache, "Кэш горячих ключей"); break;
+            case 'l':
+            case 'L': runSingleTest(testLazyDelete, "Ленивое удаление с уплотнением"); break;
+            case 'm':
+            case 'M': runSingleTest(testRangeRemoval, "Удаление диапазона"); break;
+            case 'n':
+            case 'N': runSingleTest(testSplitJoin, "Разделение и слияние деревьев"); break;
+            case 'o':
+            case 'O': runSingleTest(testReadScaling, "Масштабирование чтения"); break;
+            case 'p':
+            case 'P': runSingleTest(testFrozenIndex, "Замороженный индекс"); break;
+            case 'q':
+            case 'Q': runSingleTest(testRedistribution, "Перераспределение перед расщеплением"); break;
+            case 'r':
+            case 'R': runSingleTest(testAppendInserts, "Быстрая вставка в конец"); break;
+            case 't':
+            case 'T': runSingleTest(testPriorityQueue, "Очередь с приоритетом"); break;
+            case 'u':
+            case 'U': runSingleTest(testBufferPool, "Индекс больше памяти"); break;
+            case 'v':
+            case 'V': runSingleTest(testParallelTraversal, "Параллельный обход"); break;
+            case 'w':
+            case 'W': runSingleTest(testMultiSearch, "Пакетный поиск"); break;
             case ':': 
                 runAllTests(); break;
             case '0':
@@ -158,7 +1088,7 @@ int main() {
                 printCentered(RED "Выход из программы. До свидания!" RESET);
                 return 0;
             default:
-                printCentered(RED "Некорректный выбор! Пожалуйста, нажмите цифру от 0 до 9, s или : для прохождения всех тестов сразу." RESET);
+                printCentered(RED "Некорректный выбор! Пожалуйста, нажмите цифру от 0 до 9, букву теста или : для прохождения всех тестов сразу." RESET);
                 break;
         }
 
@@ -239,40 +1169,276 @@ void SubAllocator::deallocate(void* ptr) {
     } while (!free_list_head_.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
 }
 
-void SubAllocator::initialize_pool(void* memory, std::size_t block_count) {
-    Block* prev = nullptr;
-    for (std::size_t i = 0; i < block_count; ++i) {
-        Block* block = reinterpret_cast<Block*>(static_cast<uint8_t*>(memory) + i * BLOCK_SIZE);
-        block->next.store(prev, std::memory_order_relaxed);
-        prev = block;
+void SubAllocator::deallocate(const std::vector<void*>& blocks) {
+    if (blocks.empty()) return;
+
+    for (std::size_t i = 0; i + 1 < blocks.size(); ++i) {
+        reinterpret_cast<Block*>(blocks[i])->next.store(reinterpret_cast<Block*>(blocks[i + 1]), std::memory_order_relaxed);
     }
-    free_list_head_.store(prev, std::memory_order_release);
+
+    Block* first = reinterpret_cast<Block*>(blocks.front());
+    Block* last = reinterpret_cast<Block*>(blocks.back());
+    Block* head = free_list_head_.load(std::memory_order_acquire);
+    do {
+        last->next.store(head, std::memory_order_relaxed);
+    } while (!free_list_head_.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
 }
 
-void SubAllocator::expand_pool() {
-    std::lock_guard<std::mutex> lock(expansion_mutex_);
+std::array<ReaderBiasedMutex::ReaderSlot, ReaderBiasedMutex::READER_SLOTS> ReaderBiasedMutex::readerSlots;
 
-    if (free_list_head_.load(std::memory_order_acquire) != nullptr) {
-        return;
+ReaderBiasedMutex::ReaderBiasedMutex(LockMode mode)
+    : biasable_(mode == LockMode::ReaderBiased), readBias_(biasable_), inhibitUntil_(0) {}
+
+void ReaderBiasedMutex::lock() {
+    mutex_.lock();
+    if (readBias_.load(std::memory_order_relaxed)) {
+        revokeBias();
     }
+}
 
-    constexpr std::size_t new_block_count = INITIAL_BLOCK_COUNT; 
-    void* new_memory = ::operator new(BLOCK_SIZE * new_block_count);
+bool ReaderBiasedMutex::try_lock() {
+    if (!mutex_.try_lock()) {
+        return false;
+    }
+    if (readBias_.load(std::memory_order_relaxed)) {
+        revokeBias();
+    }
+    return true;
+}
 
-    additional_pools_.push_back(new_memory);
+void ReaderBiasedMutex::unlock() {
+    mutex_.unlock();
+}
 
-    Block* prev = nullptr;
-    for (std::size_t i = 0; i < new_block_count; ++i) {
-        Block* block = reinterpret_cast<Block*>(static_cast<uint8_t*>(new_memory) + i * BLOCK_SIZE);
-        block->next.store(prev, std::memory_order_relaxed);
-        prev = block;
+void ReaderBiasedMutex::lock_shared() {
+    if (tryFastShared()) {
+        return;
+    }
+    mutex_.lock_shared();
+    afterSlowShared();
+}
+
+bool ReaderBiasedMutex::try_lock_shared() {
+    if (tryFastShared()) {
+        return true;
+    }
+    if (!mutex_.try_lock_shared()) {
+        return false;
+    }
+    afterSlowShared();
+    return true;
+}
+
+void ReaderBiasedMutex::unlock_shared() {
+    HeldSlots& held = heldSlots();
+    for (std::size_t i = held.count; i-- > 0;) {
+        if (held.locks[i] == this) {
+            readerSlots[held.slots[i]].owner.store(nullptr, std::memory_order_release);
+            held.count--;
+            held.locks[i] = held.locks[held.count];
+            held.slots[i] = held.slots[held.count];
+            return;
+        }
+    }
+    mutex_.unlock_shared();
+}
+
+ReaderBiasedMutex::HeldSlots& ReaderBiasedMutex::heldSlots() {
+    thread_local HeldSlots held;
+    return held;
+}
+
+int64_t ReaderBiasedMutex::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool ReaderBiasedMutex::tryFastShared() {
+    if (!readBias_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    
+    HeldSlots& held = heldSlots();
+    if (held.count == MAX_HELD) {
+        return false;
+    }
+    
+    std::size_t slot = mixHash(reinterpret_cast<uintptr_t>(&held) ^ reinterpret_cast<uintptr_t>(this)) % READER_SLOTS;
+    const ReaderBiasedMutex* expected = nullptr;
+    if (!readerSlots[slot].owner.compare_exchange_strong(expected, this)) {
+        return false;
+    }
+    if (!readBias_.load()) {
+        readerSlots[slot].owner.store(nullptr, std::memory_order_release);
+        return false;
+    }
+    
+    held.locks[held.count] = this;
+    held.slots[held.count] = slot;
+    held.count++;
+    return true;
+}
+
+void ReaderBiasedMutex::afterSlowShared() {
+    if (biasable_ && !readBias_.load(std::memory_order_relaxed) &&
+        now() >= inhibitUntil_.load(std::memory_order_relaxed)) {
+        readBias_.store(true);
+    }
+}
+
+void ReaderBiasedMutex::revokeBias() {
+    readBias_.store(false);
+    int64_t start = now();
+    for (ReaderSlot& slot : readerSlots) {
+        while (slot.owner.load() == this) {
+            std::this_thread::yield();
+        }
+    }
+    int64_t finish = now();
+    inhibitUntil_.store(finish + (finish - start) * INHIBIT_MULTIPLIER, std::memory_order_relaxed);
+}
+
+WorkStealingPool& WorkStealingPool::instance() {
+    static WorkStealingPool pool;
+    return pool;
+}
+
+WorkStealingPool::WorkStealingPool() : queued_(0), stopping_(false) {
+    std::size_t count = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < count; ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        workers_.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+std::size_t WorkStealingPool::concurrency() const {
+    return workers_.size();
+}
+
+void WorkStealingPool::run(std::size_t taskCount, const std::function<void(std::size_t)>& task) {
+    if (taskCount == 0) return;
+
+    Job job{task, {taskCount}, {}, nullptr};
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        queued_.fetch_add(taskCount);
+    }
+    for (std::size_t i = 0; i < taskCount; ++i) {
+        Queue& queue = *queues_[i * queues_.size() / taskCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({&job, i});
+    }
+    wake_.notify_all();
+
+    std::size_t home = workerIndex();
+    bool owner = home != SIZE_MAX;
+    while (job.pending.load(std::memory_order_acquire) != 0) {
+        if (!runOne(owner ? home : 0, owner)) {
+            std::this_thread::yield();
+        }
+    }
+
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+}
+
+std::size_t& WorkStealingPool::workerIndex() {
+    thread_local std::size_t index = SIZE_MAX;
+    return index;
+}
+
+bool WorkStealingPool::runOne(std::size_t home, bool owner) {
+    for (std::size_t k = 0; k < queues_.size(); ++k) {
+        Queue& queue = *queues_[(home + k) % queues_.size()];
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            if (owner && k == 0) {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            } else {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+        }
+        queued_.fetch_sub(1);
+
+        Job& job = *task.job;
+        try {
+            job.task(task.index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job.errorMutex);
+            if (!job.error) {
+                job.error = std::current_exception();
+            }
+        }
+        job.pending.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::workerLoop(std::size_t index) {
+    workerIndex() = index;
+    while (true) {
+        if (runOne(index, true)) continue;
+
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return stopping_ || queued_.load() != 0; });
+        if (stopping_) return;
+    }
+}
+
+void SubAllocator::initialize_pool(void* memory, std::size_t block_count) {
+    Block* prev = nullptr;
+    for (std::size_t i = 0; i < block_count; ++i) {
+        Block* block = reinterpret_cast<Block*>(static_cast<uint8_t*>(memory) + i * BLOCK_SIZE);
+        block->next.store(prev, std::memory_order_relaxed);
+        prev = block;
+    }
+    free_list_head_.store(prev, std::memory_order_release);
+}
+
+void SubAllocator::expand_pool() {
+    std::lock_guard<std::mutex> lock(expansion_mutex_);
+
+    if (free_list_head_.load(std::memory_order_acquire) != nullptr) {
+        return;
     }
 
+    constexpr std::size_t new_block_count = INITIAL_BLOCK_COUNT; 
+    void* new_memory = ::operator new(BLOCK_SIZE * new_block_count);
+
+    additional_pools_.push_back(new_memory);
+
+    Block* prev = nullptr;
+    for (std::size_t i = 0; i < new_block_count; ++i) {
+        Block* block = reinterpret_cast<Block*>(static_cast<uint8_t*>(new_memory) + i * BLOCK_SIZE);
+        block->next.store(prev, std::memory_order_relaxed);
+        prev = block;
+    }
+
+    Block* tail = reinterpret_cast<Block*>(new_memory);
     Block* old_head = free_list_head_.load(std::memory_order_acquire);
     int retryCount = 0;
     
     do {
-        prev->next.store(old_head, std::memory_order_relaxed);
+        tail->next.store(old_head, std::memory_order_relaxed);
         
         if (retryCount++ > MAX_RETRY_ATTEMPTS) {
             std::this_thread::yield();
@@ -282,1080 +1448,6196 @@ void SubAllocator::expand_pool() {
     } while (!free_list_head_.compare_exchange_weak(old_head, prev, std::memory_order_release, std::memory_order_relaxed));
 }
 
-template <typename T>
-BTree<T>::Node::Node(bool leaf) : isLeaf(leaf) {}
+template <std::size_t N>
+InlineString<N>::InlineString() : length_(0), data_{} {}
 
-template <typename T>
-BTree<T>::Node::~Node() {
-    for (auto& child : children) {
-        delete child;
+template <std::size_t N>
+InlineString<N>::InlineString(std::string_view text) : length_(0), data_{} {
+    if (text.size() > N) {
+        throw std::length_error("InlineString: key is longer than inline capacity");
     }
+    std::memcpy(data_, text.data(), text.size());
+    length_ = static_cast<uint8_t>(text.size());
 }
 
-template <typename T>
-void* BTree<T>::Node::operator new(std::size_t /*size*/) {
-    void* ptr = SubAllocator::instance().allocate();
-    if (!ptr) {
-        throw std::bad_alloc();
+template <std::size_t N>
+InlineString<N>::InlineString(const char* text) : InlineString(std::string_view(text)) {}
+
+template <std::size_t N>
+InlineString<N>::InlineString(const std::string& text) : InlineString(std::string_view(text)) {}
+
+template <std::size_t N>
+std::string_view InlineString<N>::view() const {
+    return std::string_view(data_, length_);
+}
+
+template <std::size_t N>
+std::size_t InlineString<N>::size() const {
+    return length_;
+}
+
+template <std::size_t N>
+bool InlineString<N>::operator==(const InlineString& other) const {
+    return length_ == other.length_ && std::memcmp(data_, other.data_, length_) == 0;
+}
+
+template <std::size_t N>
+std::strong_ordering InlineString<N>::operator<=>(const InlineString& other) const {
+    int cmp = std::memcmp(data_, other.data_, std::min(length_, other.length_));
+    if (cmp != 0) {
+        return cmp < 0 ? std::strong_ordering::less : std::strong_ordering::greater;
     }
-    return ptr;
+    return length_ <=> other.length_;
 }
 
-template <typename T>
-void BTree<T>::Node::operator delete(void* ptr, std::size_t /*size*/) {
-    SubAllocator::instance().deallocate(ptr);
+template <std::size_t N>
+bool InlineString<N>::operator==(std::string_view other) const {
+    return view() == other;
 }
 
-template <typename T>
-BTree<T>::BTree(int degree) {
-    t = std::max(2, degree);  
-    root = new Node(true);
+template <std::size_t N>
+std::strong_ordering InlineString<N>::operator<=>(std::string_view other) const {
+    return view().compare(other) <=> 0;
 }
 
-template <typename T>
-BTree<T>::~BTree() {
-    delete root;
+template <std::size_t N>
+std::ostream& operator<<(std::ostream& os, const InlineString<N>& key) {
+    return os << key.view();
 }
 
 template <typename T>
-void BTree<T>::traverse() const {
-    std::shared_lock<std::shared_mutex> lock(tree_mutex);
-    if (root) {
-        traverse(root);
-    }
-    std::cout << std::endl;
+void KeyCodec<T>::encode(const T* keys, std::size_t count, std::vector<char>& out) {
+    const char* bytes = reinterpret_cast<const char*>(keys);
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
 }
 
 template <typename T>
-bool BTree<T>::search(const T& key) const {
-    std::shared_lock<std::shared_mutex> lock(tree_mutex);
-    if (!root) {
-        return false;
+std::size_t KeyCodec<T>::decode(const char* data, std::size_t available, std::size_t count, std::vector<T>& out) {
+    if (available / sizeof(T) < count) {
+        return 0;
     }
     
-    int pos;
-    return search(root, key, pos);
+    if constexpr (std::is_default_constructible_v<T>) {
+        std::size_t first = out.size();
+        out.resize(first + count);
+        std::memcpy(static_cast<void*>(out.data() + first), data, count * sizeof(T));
+    } else {
+        for (std::size_t i = 0; i < count; ++i) {
+            alignas(T) char storage[sizeof(T)];
+            std::memcpy(storage, data + i * sizeof(T), sizeof(T));
+            out.push_back(*std::launder(reinterpret_cast<T*>(storage)));
+        }
+    }
+    return count * sizeof(T);
 }
 
-template <typename T>
-void BTree<T>::insert(const T& key) {
-    std::unique_lock<std::shared_mutex> lock(tree_mutex);
-    if (!root) {
-        root = new Node(true);
+void KeyCodec<std::string>::encode(const std::string* keys, std::size_t count, std::vector<char>& out) {
+    for (std::size_t i = 0; i < count; ++i) {
+        uint32_t length = static_cast<uint32_t>(keys[i].size());
+        const char* lengthBytes = reinterpret_cast<const char*>(&length);
+        out.insert(out.end(), lengthBytes, lengthBytes + sizeof(length));
+        out.insert(out.end(), keys[i].begin(), keys[i].end());
     }
-    
-    if (root->keys.size() == 2 * t - 1) {
-        Node* newRoot = new Node(false);
-        newRoot->children.push_back(root);
-        root = newRoot;
-        splitChild(root, 0);
-        insertNonFull(root, key);
-    } else {
-        insertNonFull(root, key);
+}
+
+std::size_t KeyCodec<std::string>::decode(const char* data, std::size_t available, std::size_t count,
+                                          std::vector<std::string>& out) {
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        uint32_t length;
+        if (available - offset < sizeof(length)) {
+            return 0;
+        }
+        std::memcpy(&length, data + offset, sizeof(length));
+        offset += sizeof(length);
+        if (available - offset < length) {
+            return 0;
+        }
+        out.emplace_back(data + offset, length);
+        offset += length;
     }
+    return offset;
 }
 
-template <typename T>
-void BTree<T>::remove(const T& key) {
-    std::unique_lock<std::shared_mutex> lock(tree_mutex);
-    if (!root) {
-        return;
+uint64_t snapshotChecksum(const char* data, std::size_t size) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+    std::size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash ^= word * 0x87c37b91114253d5ULL;
+        hash = std::rotl(hash, 31) * 0x4cf5ad432745937fULL;
     }
-    
-    remove(root, key);
-    
-    if (root->keys.empty()) {
-        if (root->isLeaf) {
-        } else if (!root->children.empty()) {
-            Node* oldRoot = root;
-            root = root->children[0];
-            
-            oldRoot->children.clear();
-            delete oldRoot;
+    if (i < size) {
+        uint64_t word = 0;
+        std::memcpy(&word, data + i, size - i);
+        hash ^= word * 0x87c37b91114253d5ULL;
+        hash = std::rotl(hash, 31) * 0x4cf5ad432745937fULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+uint64_t mixHash(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+void writeAll(int fd, const char* data, std::size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::generic_category(), "write failed");
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+bool readAll(int fd, char* data, std::size_t size) {
+    while (size > 0) {
+        ssize_t bytes = ::read(fd, data, size);
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::generic_category(), "read failed");
+        }
+        if (bytes == 0) {
+            return false;
         }
+        data += bytes;
+        size -= bytes;
     }
+    return true;
+}
+
+bool syncDirectoryOf(const std::string& path) {
+    std::size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
 }
 
 template <typename T>
-void BTree<T>::splitChild(Node* parent, int index) {
-    if (!parent || index < 0 || index >= parent->children.size()) {
-        return;
+WriteAheadLog<T>::WriteAheadLog(const std::string& path)
+    : path_(path), fd_(-1), nextLsn_(0), durableLsn_(0), batches_(0), flushing_(false), failed_(false) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "WriteAheadLog: cannot open " + path);
     }
     
-    Node* y = parent->children[index];
-    if (!y || y->keys.size() < 2*t - 1) {
+    FileHeader header;
+    if (lseek(fd_, 0, SEEK_END) == 0) {
+        header = FileHeader{MAGIC, VERSION, KeyCodec<T>::KEY_SIZE};
+        writeAll(fd_, reinterpret_cast<const char*>(&header), sizeof(header));
+        fdatasync(fd_);
         return;
     }
     
-    Node* z = new Node(y->isLeaf);
+    lseek(fd_, 0, SEEK_SET);
+    if (!readAll(fd_, reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != MAGIC ||
+        header.version != VERSION || header.keySize != KeyCodec<T>::KEY_SIZE) {
+        ::close(fd_);
+        throw std::runtime_error("WriteAheadLog: " + path + " is not a compatible log");
+    }
+}
+
+template <typename T>
+WriteAheadLog<T>::~WriteAheadLog() {
+    try {
+        waitDurable(lastLsn());
+    } catch (...) {
+    }
+    ::close(fd_);
+}
+
+template <typename T>
+uint64_t WriteAheadLog<T>::append(Operation op, const T& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
     
-    parent->keys.insert(parent->keys.begin() + index, y->keys[t - 1]);
-    parent->children.insert(parent->children.begin() + index + 1, z);
+    uint64_t lsn = ++nextLsn_;
+    std::size_t start = pending_.size();
+    pending_.resize(start + sizeof(RecordHeader) + sizeof(lsn));
+    std::memcpy(pending_.data() + start + sizeof(RecordHeader), &lsn, sizeof(lsn));
+    pending_.push_back(static_cast<char>(op));
+    KeyCodec<T>::encode(&key, 1, pending_);
     
-    z->keys.assign(y->keys.begin() + t, y->keys.end());
-    y->keys.resize(t - 1);
+    RecordHeader record{static_cast<uint32_t>(pending_.size() - start - sizeof(RecordHeader)), 0, 0};
+    record.checksum = snapshotChecksum(pending_.data() + start + sizeof(RecordHeader), record.length);
+    std::memcpy(pending_.data() + start, &record, sizeof(record));
     
-    if (!y->isLeaf) {
-        z->children.assign(y->children.begin() + t, y->children.end());
-        y->children.resize(t);
-    }
+    return lsn;
 }
 
 template <typename T>
-void BTree<T>::insertNonFull(Node* node, const T& key) {
-    if (!node) return;
-    
-    int i = node->keys.size() - 1;
+uint64_t WriteAheadLog<T>::lastLsn() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return nextLsn_;
+}
+
+template <typename T>
+void WriteAheadLog<T>::waitDurable(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex_);
     
-    if (node->isLeaf) {
-        node->keys.push_back(T());
-        while (i >= 0 && key < node->keys[i]) {
-            node->keys[i + 1] = node->keys[i];
-            i--;
+    while (durableLsn_ < lsn) {
+        if (failed_) {
+            throw std::runtime_error("WriteAheadLog: log write failed");
         }
-        node->keys[i + 1] = key;
-    } else {
-        while (i >= 0 && key < node->keys[i]) {
-            i--;
+        if (flushing_) {
+            flushed_.wait(lock);
+            continue;
         }
-        i++;
         
-        if (i < node->children.size() && node->children[i] && 
-            node->children[i]->keys.size() == 2 * t - 1) {
-            splitChild(node, i);
-            if (key > node->keys[i]) {
-                i++;
-            }
+        flushing_ = true;
+        std::vector<char> batch;
+        batch.swap(pending_);
+        uint64_t batchLsn = nextLsn_;
+        lock.unlock();
+        
+        bool ok = true;
+        try {
+            writeAll(fd_, batch.data(), batch.size());
+            ok = fdatasync(fd_) == 0;
+        } catch (const std::system_error&) {
+            ok = false;
         }
         
-        if (i < node->children.size() && node->children[i]) {
-            insertNonFull(node->children[i], key);
+        lock.lock();
+        flushing_ = false;
+        if (ok) {
+            durableLsn_ = batchLsn;
+            batches_++;
+        } else {
+            failed_ = true;
         }
+        flushed_.notify_all();
     }
 }
 
 template <typename T>
-bool BTree<T>::search(Node* node, const T& key, int& pos) const {
-    if (!node) return false;
-    
-    int i = 0;
-    while (i < node->keys.size() && key > node->keys[i]) {
-        i++;
-    }
+template <typename F>
+std::size_t WriteAheadLog<T>::replay(F&& apply, uint64_t afterLsn) {
+    std::lock_guard<std::mutex> lock(mutex_);
     
-    if (i < node->keys.size() && key == node->keys[i]) {
-        pos = i;
-        return true;
-    }
+    std::vector<char> data = readRecords();
+    std::size_t offset = 0;
+    std::size_t records = 0;
+    std::vector<T> keys;
     
-    if (node->isLeaf) {
-        return false;
+    while (data.size() - offset >= sizeof(RecordHeader)) {
+        RecordHeader record;
+        std::memcpy(&record, data.data() + offset, sizeof(record));
+        const char* payload = data.data() + offset + sizeof(RecordHeader);
+        std::size_t available = data.size() - offset - sizeof(RecordHeader);
+        
+        if (record.length <= sizeof(uint64_t) || record.length > available ||
+            snapshotChecksum(payload, record.length) != record.checksum) {
+            break;
+        }
+        
+        uint64_t lsn;
+        std::memcpy(&lsn, payload, sizeof(lsn));
+        std::size_t keyBytes = record.length - sizeof(lsn) - 1;
+        
+        keys.clear();
+        if (KeyCodec<T>::decode(payload + sizeof(lsn) + 1, keyBytes, 1, keys) != keyBytes || keys.size() != 1) {
+            break;
+        }
+        
+        if (lsn > afterLsn) {
+            apply(static_cast<Operation>(payload[sizeof(lsn)]), std::move(keys.front()));
+            records++;
+        }
+        nextLsn_ = std::max(nextLsn_, lsn);
+        offset += sizeof(RecordHeader) + record.length;
     }
     
-    if (i < node->children.size()) {
-        return search(node->children[i], key, pos);
+    if (offset != data.size() && ftruncate(fd_, sizeof(FileHeader) + offset) != 0) {
+        throw std::system_error(errno, std::generic_category(), "WriteAheadLog: cannot cut torn tail");
     }
     
-    return false;
+    nextLsn_ = std::max(nextLsn_, afterLsn);
+    durableLsn_ = nextLsn_;
+    return records;
 }
 
 template <typename T>
-T BTree<T>::getPredecessor(Node* node, int index) {
-    if (!node || index < 0 || index >= node->children.size() || !node->children[index]) {
-        return T();
+void WriteAheadLog<T>::truncate(uint64_t throughLsn) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    flushed_.wait(lock, [this] { return !flushing_; });
+    if (failed_) {
+        throw std::runtime_error("WriteAheadLog: log write failed");
     }
     
-    Node* current = node->children[index];
-    while (!current->isLeaf && !current->children.empty()) {
-        current = current->children[current->children.size() - 1];
+    flushing_ = true;
+    std::vector<char> batch;
+    batch.swap(pending_);
+    uint64_t batchLsn = nextLsn_;
+    lock.unlock();
+    
+    std::string tempPath = path_ + ".tmp";
+    int tempFd = -1;
+    bool ok = true;
+    try {
+        writeAll(fd_, batch.data(), batch.size());
+        std::vector<char> data = readRecords();
+        
+        std::size_t offset = 0;
+        while (data.size() - offset >= sizeof(RecordHeader) + sizeof(uint64_t)) {
+            RecordHeader record;
+            uint64_t lsn;
+            std::memcpy(&record, data.data() + offset, sizeof(record));
+            std::memcpy(&lsn, data.data() + offset + sizeof(record), sizeof(lsn));
+            if (record.length > data.size() - offset - sizeof(RecordHeader) || lsn > throughLsn) {
+                break;
+            }
+            offset += sizeof(RecordHeader) + record.length;
+        }
+        offset = std::min(offset, data.size());
+        
+        FileHeader header{MAGIC, VERSION, KeyCodec<T>::KEY_SIZE};
+        tempFd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (tempFd < 0) {
+            throw std::system_error(errno, std::generic_category(), "WriteAheadLog: cannot create " + tempPath);
+        }
+        writeAll(tempFd, reinterpret_cast<const char*>(&header), sizeof(header));
+        writeAll(tempFd, data.data() + offset, data.size() - offset);
+        ok = fdatasync(tempFd) == 0 && ::rename(tempPath.c_str(), path_.c_str()) == 0 && syncDirectoryOf(path_);
+        ::close(tempFd);
+        
+        int newFd = ok ? ::open(path_.c_str(), O_RDWR | O_APPEND) : -1;
+        if (newFd >= 0) {
+            ::close(fd_);
+            fd_ = newFd;
+        } else {
+            ok = false;
+        }
+    } catch (const std::system_error&) {
+        if (tempFd >= 0) {
+            ::close(tempFd);
+        }
+        ok = false;
     }
     
-    if (current->keys.empty()) {
-        return T();
+    lock.lock();
+    flushing_ = false;
+    if (ok) {
+        durableLsn_ = batchLsn;
+    } else {
+        failed_ = true;
     }
+    flushed_.notify_all();
     
-    return current->keys[current->keys.size() - 1];
+    if (!ok) {
+        throw std::runtime_error("WriteAheadLog: cannot truncate log");
+    }
 }
 
 template <typename T>
-T BTree<T>::getSuccessor(Node* node, int index) {
-    if (!node || index < 0 || index + 1 >= node->children.size() || !node->children[index + 1]) {
-        return T();
-    }
-    
-    Node* current = node->children[index + 1];
-    while (!current->isLeaf && !current->children.empty()) {
-        current = current->children[0];
-    }
-    
-    if (current->keys.empty()) {
-        return T();
+std::vector<char> WriteAheadLog<T>::readRecords() const {
+    off_t end = lseek(fd_, 0, SEEK_END);
+    std::vector<char> data(end - sizeof(FileHeader));
+    if (pread(fd_, data.data(), data.size(), sizeof(FileHeader)) != static_cast<ssize_t>(data.size())) {
+        throw std::system_error(errno, std::generic_category(), "WriteAheadLog: cannot read log");
     }
-    
-    return current->keys[0];
+    return data;
 }
 
 template <typename T>
-void BTree<T>::mergeNodes(Node* node, int index) {
-    if (!node || index < 0 || index >= node->children.size() - 1) {
-        return;
-    }
-    
-    Node* child = node->children[index];
-    Node* sibling = node->children[index + 1];
-    
-    if (!child || !sibling) {
-        return;
-    }
-    
-    if (index < node->keys.size()) {
-        child->keys.push_back(node->keys[index]);
-        
-        child->keys.insert(child->keys.end(), sibling->keys.begin(), sibling->keys.end());
-        
-        if (!child->isLeaf) {
-            child->children.insert(child->children.end(), sibling->children.begin(), sibling->children.end());
-            sibling->children.clear();
+uint64_t WriteAheadLog<T>::batchCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return batches_;
+}
+
+template <typename T>
+KeyFilter<T>::KeyFilter(std::size_t capacity)
+    : blockCount((capacity * COUNTERS_PER_KEY + WORDS_PER_BLOCK * COUNTERS_PER_WORD - 1) / (WORDS_PER_BLOCK * COUNTERS_PER_WORD)),
+      capacity_(capacity), keys(0), negatives(0), falsePositives(0) {
+    blocks = std::make_unique<Block[]>(blockCount);
+}
+
+template <typename T>
+bool KeyFilter<T>::mayContain(const T& key) const {
+    bool present = true;
+    forEachCounter(key, [&present](std::atomic<uint64_t>& word, unsigned shift) {
+        present = present && ((word.load(std::memory_order_relaxed) >> shift) & 0xF) != 0;
+    });
+    return present;
+}
+
+template <typename T>
+void KeyFilter<T>::add(const T& key) {
+    forEachCounter(key, [](std::atomic<uint64_t>& word, unsigned shift) {
+        uint64_t value = word.load(std::memory_order_relaxed);
+        while (((value >> shift) & 0xF) != 0xF &&
+               !word.compare_exchange_weak(value, value + (uint64_t(1) << shift), std::memory_order_relaxed)) {
         }
-        
-        node->keys.erase(node->keys.begin() + index);
-        
-        node->children.erase(node->children.begin() + index + 1);
-        
-        delete sibling;
-    }
+    });
+    keys.fetch_add(1, std::memory_order_relaxed);
 }
 
 template <typename T>
-void BTree<T>::borrowFromPrev(Node* node, int index) {
-    if (!node || index <= 0 || index >= node->children.size()) {
-        return;
+void KeyFilter<T>::remove(const T& key) {
+    forEachCounter(key, [](std::atomic<uint64_t>& word, unsigned shift) {
+        uint64_t value = word.load(std::memory_order_relaxed);
+        while (((value >> shift) & 0xF) != 0xF && ((value >> shift) & 0xF) != 0 &&
+               !word.compare_exchange_weak(value, value - (uint64_t(1) << shift), std::memory_order_relaxed)) {
+        }
+    });
+    keys.fetch_sub(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+void KeyFilter<T>::recordNegative() {
+    negatives.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+void KeyFilter<T>::recordFalsePositive() {
+    falsePositives.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+bool KeyFilter<T>::degraded() const {
+    if (keys.load(std::memory_order_relaxed) > capacity_) {
+        return true;
     }
     
-    Node* child = node->children[index];
-    Node* sibling = node->children[index - 1];
+    std::size_t misses = falsePositives.load(std::memory_order_relaxed);
+    std::size_t checks = misses + negatives.load(std::memory_order_relaxed);
+    return checks >= CHECK_INTERVAL && misses * 20 > checks;
+}
+
+template <typename T>
+std::size_t KeyFilter<T>::capacity() const {
+    return capacity_;
+}
+
+template <typename T>
+template <typename F>
+void KeyFilter<T>::forEachCounter(const T& key, F&& fn) const {
+    uint64_t hash = mixHash(std::hash<T>{}(key));
+    Block& block = blocks[(hash >> 32) % blockCount];
     
-    if (!child || !sibling || sibling->keys.empty()) {
-        return;
+    for (int i = 0; i < PROBES; ++i) {
+        unsigned counter = (hash >> (7 * i)) & (WORDS_PER_BLOCK * COUNTERS_PER_WORD - 1);
+        fn(block.words[counter / COUNTERS_PER_WORD], (counter % COUNTERS_PER_WORD) * 4);
     }
-    
-    child->keys.insert(child->keys.begin(), node->keys[index - 1]);
-    
-    if (index - 1 < node->keys.size()) {
-        node->keys[index - 1] = sibling->keys.back();
-        sibling->keys.pop_back();
-        
-        if (!child->isLeaf && !sibling->children.empty()) {
-            child->children.insert(child->children.begin(), sibling->children.back());
-            sibling->children.pop_back();
+}
+
+template <typename Tree>
+template <typename Ref, typename K>
+std::size_t BTreeAlgorithms<Tree>::findKey(const Tree& tree, Ref node, const K& key) {
+    std::size_t lo = 0;
+    std::size_t hi = tree.keyCount(node);
+    while (lo < hi) {
+        std::size_t mid = (lo + hi) / 2;
+        if (tree.keyAt(node, mid) < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
+    return lo;
 }
 
-template <typename T>
-void BTree<T>::borrowFromNext(Node* node, int index) {
-    if (!node || index < 0 || index >= node->children.size() - 1 || index >= node->keys.size()) {
-        return;
+template <typename Tree>
+template <typename Ref, typename K>
+std::size_t BTreeAlgorithms<Tree>::findInsertPos(const Tree& tree, Ref node, const K& key) {
+    std::size_t lo = 0;
+    std::size_t hi = tree.keyCount(node);
+    while (lo < hi) {
+        std::size_t mid = (lo + hi) / 2;
+        if (key < tree.keyAt(node, mid)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
     }
-    
-    Node* child = node->children[index];
-    Node* sibling = node->children[index + 1];
-    
-    if (!child || !sibling || sibling->keys.empty()) {
-        return;
+    return lo;
+}
+
+template <typename Tree>
+template <typename Ref, typename K>
+Ref BTreeAlgorithms<Tree>::find(const Tree& tree, Ref node, const K& key, std::size_t& pos) {
+    while (true) {
+        std::size_t i = findKey(tree, node, key);
+        if (i < tree.keyCount(node) && key == tree.keyAt(node, i)) {
+            pos = i;
+            return node;
+        }
+        if (tree.isLeaf(node)) {
+            return Ref{};
+        }
+        node = tree.childAt(node, i);
     }
-    
-    child->keys.push_back(node->keys[index]);
-    
-    node->keys[index] = sibling->keys.front();
-    sibling->keys.erase(sibling->keys.begin());
-    
-    if (!child->isLeaf && !sibling->children.empty()) {
-        child->children.push_back(sibling->children.front());
-        sibling->children.erase(sibling->children.begin());
+}
+
+template <typename Tree>
+template <typename Path, typename Ref>
+void BTreeAlgorithms<Tree>::splitUpward(Tree& tree, Path& path, Ref node, Ref& top) {
+    while (tree.keyCount(node) > tree.maxKeys()) {
+        if (path.empty()) {
+            top = tree.growRoot(node);
+            return;
+        }
+        
+        auto parent = path.pop();
+        if (tree.absorbOverflow(parent.node, parent.index)) {
+            return;
+        }
+        node = parent.node;
     }
 }
 
-template <typename T>
-void BTree<T>::fill(Node* node, int index) {
-    if (!node || index < 0 || index >= node->children.size()) {
+template <typename Tree>
+template <typename Ref>
+void BTreeAlgorithms<Tree>::fill(Tree& tree, Ref parent, int index) {
+    std::size_t last = tree.keyCount(parent);
+    if (index < 0 || static_cast<std::size_t>(index) > last) {
         return;
     }
     
-    if (index > 0 && node->children[index - 1] && node->children[index - 1]->keys.size() >= t) {
-        borrowFromPrev(node, index);
-    } 
-    else if (index < node->children.size() - 1 && node->children[index + 1] && 
-            node->children[index + 1]->keys.size() >= t) {
-        borrowFromNext(node, index);
-    } 
-    else {
-        if (index < node->children.size() - 1) {
-            mergeNodes(node, index);
-        } else if (index > 0) {
-            mergeNodes(node, index - 1);
-        }
+    std::size_t i = index;
+    if (i > 0 && tree.keyCount(tree.childAt(parent, i - 1)) > tree.minKeys()) {
+        tree.borrowFromPrev(parent, index);
+    } else if (i < last && tree.keyCount(tree.childAt(parent, i + 1)) > tree.minKeys()) {
+        tree.borrowFromNext(parent, index);
+    } else if (i < last) {
+        tree.mergeNodes(parent, index);
+    } else if (i > 0) {
+        tree.mergeNodes(parent, index - 1);
+    }
+}
+
+template <typename Tree>
+template <typename Path, typename Ref>
+void BTreeAlgorithms<Tree>::rebalanceUpward(Tree& tree, Path& path, Ref node) {
+    while (tree.keyCount(node) < tree.minKeys() && !path.empty()) {
+        auto parent = path.pop();
+        fill(tree, parent.node, parent.index);
+        node = parent.node;
     }
 }
 
 template <typename T>
-void BTree<T>::removeFromLeaf(Node* node, int index) {
-    if (!node || index < 0 || index >= node->keys.size()) {
-        return;
+BTree<T>::Node::Node(bool leaf) : isLeaf(leaf), dirtyEpoch(0), count(0) {}
+
+template <typename T>
+BTree<T>::Node::~Node() {
+    for (auto& child : children) {
+        delete child;
     }
-    node->keys.erase(node->keys.begin() + index);
 }
 
 template <typename T>
-void BTree<T>::removeFromNonLeaf(Node* node, int index) {
-    if (!node || index < 0 || index >= node->keys.size()) {
-        return;
+void* BTree<T>::Node::operator new(std::size_t /*size*/) {
+    static_assert(sizeof(Node) <= SubAllocator::BLOCK_SIZE, "Node must fit into one SubAllocator block");
+    void* ptr = SubAllocator::instance().allocate();
+    if (!ptr) {
+        throw std::bad_alloc();
     }
-    
-    T key = node->keys[index];
-    
-    if (index < node->children.size() && node->children[index] && node->children[index]->keys.size() >= t) {
-        T pred = getPredecessor(node, index);
-        node->keys[index] = pred;
-        remove(node->children[index], pred);
-    } 
-    else if (index + 1 < node->children.size() && node->children[index + 1] && 
-            node->children[index + 1]->keys.size() >= t) {
-        T succ = getSuccessor(node, index);
-        node->keys[index] = succ;
-        remove(node->children[index + 1], succ);
-    } 
-    else if (index < node->children.size() - 1 && node->children[index] && node->children[index + 1]) {
-        mergeNodes(node, index);
-        remove(node->children[index], key);
+    return ptr;
+}
+
+template <typename T>
+void BTree<T>::Node::operator delete(void* ptr, std::size_t /*size*/) {
+    SubAllocator::instance().deallocate(ptr);
+}
+
+template <typename T>
+void BTree<T>::Path::push(Node* node, int index) {
+    if (depth >= MAX_HEIGHT) {
+        throw std::length_error("BTree: path stack overflow");
     }
+    entries[depth++] = PathEntry{node, index};
 }
 
 template <typename T>
-int BTree<T>::findKey(Node* node, const T& key) {
-    int index = 0;
-    if (!node) return index;
-    
-    while (index < node->keys.size() && node->keys[index] < key) {
-        ++index;
+typename BTree<T>::PathEntry BTree<T>::Path::pop() {
+    return entries[--depth];
+}
+
+template <typename T>
+bool BTree<T>::Path::empty() const {
+    return depth == 0;
+}
+
+template <typename T>
+BTree<T>::BTree(int degree, LockMode locking)
+    : tree_mutex(locking), wal(nullptr), shapeEpoch(0), appendStreak(0), appending(false), spineUnderfull(false), checkpointEpoch(0), filterInstalled(false), filterStale(false),
+      treeId(nextTreeId.fetch_add(1, std::memory_order_relaxed)), version(0), cacheEnabled(false),
+      lazyDelete(false), redistributeOnSplit(false) {
+    t = std::max(2, degree);  
+    root = new Node(true);
+}
+
+template <typename T>
+BTree<T>::~BTree() {
+    delete root;
+}
+
+template <typename T>
+void BTree<T>::traverse() const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (root) {
+        traverse(root);
     }
-    return index;
+    std::cout << std::endl;
 }
 
 template <typename T>
-void BTree<T>::remove(Node* node, const T& key) {
-    if (!node) {
-        return;
+template <typename K> requires KeyComparableWith<K, T>
+bool BTree<T>::search(const K& key) const {
+    CacheSlot* slot = nullptr;
+    if constexpr (std::same_as<K, T> && CacheableKey<T>) {
+        if (cacheEnabled.load(std::memory_order_relaxed)) {
+            slot = &lookupCache()[mixHash(std::hash<T>{}(key)) % CACHE_SLOTS];
+            if (slot->tree == treeId && slot->version == version.load(std::memory_order_acquire) && slot->key == key) {
+                return slot->found;
+            }
+        }
+    }
+    
+    std::shared_ptr<KeyFilter<T>> keyFilter;
+    if constexpr (std::same_as<K, T> && HashableKey<T>) {
+        if (filterInstalled.load(std::memory_order_acquire)) {
+            keyFilter = filter.load(std::memory_order_acquire);
+        }
+        if (keyFilter && !keyFilter->mayContain(key)) {
+            keyFilter->recordNegative();
+            return false;
+        }
     }
     
-    int index = findKey(node, key);
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root) {
+        return false;
+    }
     
-    if (index < node->keys.size() && node->keys[index] == key) {
-        if (node->isLeaf) {
-            removeFromLeaf(node, index);
-        } else {
-            removeFromNonLeaf(node, index);
+    std::size_t pos;
+    bool found = BTreeAlgorithms<BTree>::find(*this, root, key, pos) != nullptr;
+    if constexpr (std::same_as<K, T> && CacheableKey<T>) {
+        if (slot) {
+            *slot = CacheSlot{treeId, version.load(std::memory_order_relaxed), key, found};
         }
-    } 
-    else {
-        if (node->isLeaf) {
-            return;
+    }
+    if (keyFilter && !found) {
+        keyFilter->recordFalsePositive();
+        if (keyFilter->degraded() && !filterStale.load(std::memory_order_relaxed)) {
+            filterStale.store(true, std::memory_order_relaxed);
         }
-        
-        bool flag = (index == node->keys.size());
-        
-        if (index < node->children.size() && node->children[index] && 
-            node->children[index]->keys.size() < t) {
-            fill(node, index);
+    }
+    return found;
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+void BTree<T>::multiSearch(const std::vector<K>& keys, std::vector<bool>& found) const {
+    found.assign(keys.size(), false);
+    if (keys.empty()) return;
+    
+    std::vector<std::size_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (!std::is_sorted(keys.begin(), keys.end())) {
+        std::sort(order.begin(), order.end(), [&keys](std::size_t a, std::size_t b) { return keys[a] < keys[b]; });
+    }
+    
+    struct Level {
+        Node* node;
+        std::size_t index;
+        const T* upper;
+    };
+    std::array<Level, MAX_HEIGHT> levels;
+    
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root) return;
+    
+    int depth = 0;
+    levels[depth++] = {root, 0, nullptr};
+    for (std::size_t n = 0; n < order.size(); ++n) {
+        const K& key = keys[order[n]];
+        while (depth > 1 && levels[depth - 1].upper && !(key < *levels[depth - 1].upper)) {
+            --depth;
         }
         
-        if (flag && index > node->children.size() - 1) {
-            if (index > 0) {
-                index = node->children.size() - 1;
-            } else {
-                return;
+        const K* ahead = n + MULTI_SEARCH_LOOKAHEAD < order.size() ? &keys[order[n + MULTI_SEARCH_LOOKAHEAD]] : nullptr;
+        while (true) {
+            Level& level = levels[depth - 1];
+            Node* node = level.node;
+            std::size_t i = level.index;
+            while (i < node->keys.size() && node->keys[i] < key) {
+                ++i;
             }
-        }
-        
-        if (index < node->children.size() && node->children[index]) {
-            remove(node->children[index], key);
+            level.index = i;
+            
+            if (i < node->keys.size() && key == node->keys[i]) {
+                found[order[n]] = true;
+                break;
+            }
+            if (node->isLeaf) {
+                break;
+            }
+            
+            if (ahead) {
+                std::size_t j = i;
+                while (j < node->keys.size() && node->keys[j] < *ahead) {
+                    ++j;
+                }
+                if (j != i) {
+                    __builtin_prefetch(node->children[j]);
+                }
+            }
+            levels[depth++] = {node->children[i], 0, i < node->keys.size() ? &node->keys[i] : level.upper};
         }
     }
 }
 
 template <typename T>
-void BTree<T>::traverse(Node* node) const {
-    if (!node) return;
-    
-    int i;
-    for (i = 0; i < node->keys.size(); i++) {
-        if (!node->isLeaf && i < node->children.size() && node->children[i]) {
-            traverse(node->children[i]);
-        }
-        std::cout << node->keys[i] << " ";
+void BTree<T>::insert(const T& key) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root) {
+        root = new Node(true);
+        markDirty(root);
     }
     
-    if (!node->isLeaf && i < node->children.size() && node->children[i]) {
-        traverse(node->children[i]);
+    insert(root, key);
+    waitForLog(lock);
+}
+
+template <typename T>
+void BTree<T>::insert(T&& key) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root) {
+        root = new Node(true);
+        markDirty(root);
     }
+    
+    insert(root, std::move(key));
+    waitForLog(lock);
 }
 
-void printFrameTop() {
-    int termWidth = getTerminalWidth();
-    std::cout << CYAN << std::string(termWidth, '=') << RESET << std::endl;
+template <typename T>
+template <typename... Args>
+void BTree<T>::emplace(Args&&... args) {
+    insert(T(std::forward<Args>(args)...));
 }
 
-void printFrameBottom() {
-    int termWidth = getTerminalWidth();
-    std::cout << CYAN << std::string(termWidth, '=') << RESET << std::endl;
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+void BTree<T>::remove(const K& key) {
+    erase(key);
 }
 
-void showProgressBar(int percent, bool isRunningAllTests) {
-    int termWidth = getTerminalWidth();
-    int width = termWidth * 0.6; 
-    
-    int pos = percent * width / 100;
+template <typename T>
+bool BTree<T>::insert_if_absent(const T& key) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root) {
+        root = new Node(true);
+        markDirty(root);
+    }
     
-    std::string progressBar = BOLDWHITE "[";
+    bool inserted = insertUnique(root, key, [](T&) { return false; });
+    waitForLog(lock);
+    return inserted;
+}
+
+template <typename T>
+bool BTree<T>::insert_if_absent(T&& key) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root) {
+        root = new Node(true);
+        markDirty(root);
+    }
     
-    for (int i = 0; i < width; ++i) {
-        if (i < pos) progressBar += GREEN "=";
-        else if (i == pos) progressBar += YELLOW ">";
-        else progressBar += RESET " ";
+    bool inserted = insertUnique(root, std::move(key), [](T&) { return false; });
+    waitForLog(lock);
+    return inserted;
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+bool BTree<T>::erase(const K& key) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root) {
+        return false;
     }
     
-    progressBar += BOLDWHITE "] " + std::to_string(percent) + "%";
+    bool removed = remove(root, key);
+    collapseRoot();
+    waitForLog(lock);
+    return removed;
+}
+
+template <typename T>
+template <typename F>
+bool BTree<T>::upsert(const T& key, F&& update) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root) {
+        root = new Node(true);
+        markDirty(root);
+    }
     
-    int visibleLength = width + 6; 
-    int padding = std::max(0, (termWidth - visibleLength) / 2);
+    bool inserted = insertUnique(root, key, [this, &update](T& stored) {
+        update(stored);
+        onUpdated(stored);
+        return true;
+    });
+    waitForLog(lock);
+    return inserted;
+}
+
+template <typename T>
+template <typename K, typename F> requires KeyComparableWith<K, T>
+bool BTree<T>::update_or_erase(const K& key, F&& update) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root) {
+        return false;
+    }
     
-    std::cout << "\r" << std::string(padding, ' ') << progressBar << RESET;
-    std::cout.flush();
+    bool found = remove(root, key, std::forward<F>(update));
+    collapseRoot();
+    waitForLog(lock);
+    return found;
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+std::optional<T> BTree<T>::find(const K& key) const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
     
-    if (percent == 100 && !isRunningAllTests) {
-        std::cout << std::endl;
+    const T* stored = locate(key);
+    if (!stored) {
+        return std::nullopt;
     }
+    return *stored;
 }
 
-int getTerminalWidth() {
-    struct winsize w;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-    return w.ws_col;
+template <typename T>
+std::size_t BTree<T>::size() const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    return root ? root->count : 0;
 }
 
-void printCentered(const std::string& text) {
-    int termWidth = getTerminalWidth();
-    std::string plainText = text;
-    
-    size_t colorPos = 0;
-    int colorLen = 0;
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+std::size_t BTree<T>::rank(const K& key) const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    return rank(root, key, false);
+}
+
+template <typename T>
+std::optional<T> BTree<T>::min() const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root || root->count == 0) {
+        return std::nullopt;
+    }
+    return edgeLeaf(leftHint, false)->keys.front();
+}
+
+template <typename T>
+std::optional<T> BTree<T>::max() const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root || root->count == 0) {
+        return std::nullopt;
+    }
+    return edgeLeaf(rightHint, true)->keys.back();
+}
+
+template <typename T>
+std::optional<T> BTree<T>::pop_min() {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    std::optional<T> key = popEdge(false);
+    waitForLog(lock);
+    return key;
+}
+
+template <typename T>
+std::optional<T> BTree<T>::pop_max() {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    std::optional<T> key = popEdge(true);
+    waitForLog(lock);
+    return key;
+}
+
+template <typename T>
+T BTree<T>::select(std::size_t k) const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root || k >= root->count) {
+        throw std::out_of_range("BTree::select: index out of range");
+    }
     
-    while (true) {
-        colorPos = plainText.find("\033[", colorPos);
-        if (colorPos == std::string::npos) break;
-        
-        size_t endPos = plainText.find('m', colorPos);
-        if (endPos != std::string::npos) {
-            int len = endPos - colorPos + 1;
-            plainText.erase(colorPos, len);
-            colorLen += len;
+    Node* node = root;
+    while (!node->isLeaf) {
+        int i = 0;
+        while (k >= node->children[i]->count) {
+            k -= node->children[i]->count;
+            if (k == 0) {
+                return node->keys[i];
+            }
+            k--;
+            i++;
+        }
+        node = node->children[i];
+    }
+    
+    return node->keys[k];
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+std::size_t BTree<T>::countRange(const K& lo, const K& hi) const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (hi < lo) {
+        return 0;
+    }
+    return rank(root, hi, true) - rank(root, lo, false);
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+std::size_t BTree<T>::removeRange(const K& lo, const K& hi) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    if (!root || hi < lo) {
+        return 0;
+    }
+    
+    settleUnderfull(underfullKeys.size());
+    auto [left, rest] = splitNodes(root, lo, false);
+    auto [middle, right] = splitNodes(rest, hi, true);
+    root = concatNodes(left, right);
+    if (!root) {
+        root = new Node(true);
+        markDirty(root);
+    }
+    
+    std::size_t removed = middle ? middle->count : 0;
+    if (wal || filterInstalled.load(std::memory_order_relaxed)) {
+        forEachRun(middle, [this](const T* run, std::size_t count) {
+            for (std::size_t i = 0; i < count; ++i) {
+                onRemoved(run[i]);
+            }
+        });
+    }
+    version.fetch_add(1, std::memory_order_release);
+    shapeEpoch++;
+    releaseNodes(middle);
+    
+    waitForLog(lock);
+    return removed;
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+void BTree<T>::split(const K& key, BTree& other) {
+    if (&other == this) {
+        throw std::invalid_argument("BTree::split: target is the same tree");
+    }
+    
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex, std::defer_lock);
+    std::unique_lock<ReaderBiasedMutex> otherLock(other.tree_mutex, std::defer_lock);
+    std::lock(lock, otherLock);
+    if (other.t != t) {
+        throw std::invalid_argument("BTree::split: trees have different degrees");
+    }
+    if (other.root && other.root->count != 0) {
+        throw std::invalid_argument("BTree::split: target tree is not empty");
+    }
+    if (!root) {
+        return;
+    }
+    
+    settleUnderfull(underfullKeys.size());
+    auto [left, right] = splitNodes(root, key, false);
+    root = left ? left : new Node(true);
+    markDirty(root);
+    
+    other.adoptNodes(right, *this);
+    other.releaseNodes(other.root);
+    other.root = right ? right : new Node(true);
+    other.markDirty(other.root);
+    
+    waitForLog(lock);
+    other.waitForLog(otherLock);
+}
+
+template <typename T>
+void BTree<T>::join(BTree& other) {
+    if (&other == this) {
+        throw std::invalid_argument("BTree::join: cannot join a tree with itself");
+    }
+    
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex, std::defer_lock);
+    std::unique_lock<ReaderBiasedMutex> otherLock(other.tree_mutex, std::defer_lock);
+    std::lock(lock, otherLock);
+    if (other.t != t) {
+        throw std::invalid_argument("BTree::join: trees have different degrees");
+    }
+    
+    settleUnderfull(underfullKeys.size());
+    other.settleUnderfull(other.underfullKeys.size());
+    if (!other.root || other.root->count == 0) {
+        return;
+    }
+    if (!root) {
+        root = new Node(true);
+    }
+    
+    Node* piece = other.root;
+    if (root->count != 0) {
+        if (!(edgeKey(piece, false) < edgeKey(root, true))) {
+            adoptNodes(piece, other);
+            root = concatNodes(root, piece);
+        } else if (!(edgeKey(root, false) < edgeKey(piece, true))) {
+            adoptNodes(piece, other);
+            root = concatNodes(piece, root);
         } else {
+            throw std::invalid_argument("BTree::join: key ranges overlap");
+        }
+    } else {
+        adoptNodes(piece, other);
+        releaseNodes(root);
+        root = piece;
+    }
+    markDirty(root);
+    
+    other.root = new Node(true);
+    other.markDirty(other.root);
+    
+    waitForLog(lock);
+    other.waitForLog(otherLock);
+}
+
+template <typename T>
+template <typename F>
+void BTree<T>::parallel_for_each(F&& fn) const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    WorkStealingPool& pool = WorkStealingPool::instance();
+    std::vector<Partition> parts = partition(4 * pool.concurrency());
+    
+    pool.run(parts.size(), [&](std::size_t i) {
+        if (parts[i].separator) {
+            fn(*parts[i].separator);
+            return;
+        }
+        forEachRun(parts[i].subtree, [&fn](const T* run, std::size_t count) {
+            for (std::size_t j = 0; j < count; ++j) {
+                fn(run[j]);
+            }
+        });
+    });
+}
+
+template <typename T>
+template <typename R, typename Accumulate, typename Combine>
+R BTree<T>::parallel_reduce(R identity, Accumulate&& accumulate, Combine&& combine) const {
+    std::vector<std::optional<R>> partials;
+    {
+        std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+        WorkStealingPool& pool = WorkStealingPool::instance();
+        std::vector<Partition> parts = partition(4 * pool.concurrency());
+        partials.resize(parts.size());
+        
+        pool.run(parts.size(), [&](std::size_t i) {
+            R partial = identity;
+            if (parts[i].separator) {
+                partial = accumulate(std::move(partial), *parts[i].separator);
+            } else {
+                forEachRun(parts[i].subtree, [&](const T* run, std::size_t count) {
+                    for (std::size_t j = 0; j < count; ++j) {
+                        partial = accumulate(std::move(partial), run[j]);
+                    }
+                });
+            }
+            partials[i].emplace(std::move(partial));
+        });
+    }
+    
+    R result = std::move(identity);
+    for (std::optional<R>& partial : partials) {
+        result = combine(std::move(result), std::move(*partial));
+    }
+    return result;
+}
+
+template <typename T>
+FrozenIndex<T> BTree<T>::freeze() const {
+    std::vector<T> keys;
+    {
+        std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+        keys.reserve(root ? root->count : 0);
+        forEachRun(root, [&keys](const T* run, std::size_t count) {
+            keys.insert(keys.end(), run, run + count);
+        });
+    }
+    return FrozenIndex<T>(std::move(keys));
+}
+
+template <typename T>
+std::size_t BTree<T>::memoryUsage() const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    std::size_t bytes = sizeof(*this);
+    if (!root) return bytes;
+    
+    std::vector<Node*> stack{root};
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        bytes += SubAllocator::BLOCK_SIZE + node->keys.capacity() * sizeof(T) + node->children.capacity() * sizeof(Node*);
+        stack.insert(stack.end(), node->children.begin(), node->children.end());
+    }
+    return bytes;
+}
+
+template <typename T>
+typename BTree<T>::Stats BTree<T>::stats() const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    Stats result{0, 0, height(root) + 1, 0.0, 0};
+    if (!root) return result;
+    
+    std::vector<Node*> stack{root};
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        result.keys += node->keys.size();
+        result.nodes++;
+        if (node != root && node->keys.size() < minKeys()) {
+            result.underfull++;
+        }
+        stack.insert(stack.end(), node->children.begin(), node->children.end());
+    }
+    result.utilization = static_cast<double>(result.keys) / (result.nodes * (2 * t - 1));
+    return result;
+}
+
+template <typename T>
+void BTree<T>::attachLog(WriteAheadLog<T>* log) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    wal = log;
+}
+
+template <typename T>
+std::size_t BTree<T>::recover(WriteAheadLog<T>& log, uint64_t afterLsn) {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    wal = nullptr;
+    
+    std::size_t records = log.replay([this](typename WriteAheadLog<T>::Operation op, T&& key) {
+        if (op == WriteAheadLog<T>::Operation::Insert) {
+            insert(root, std::move(key));
+        } else if (op == WriteAheadLog<T>::Operation::Remove) {
+            remove(root, key);
+            collapseRoot();
+        } else if (op == WriteAheadLog<T>::Operation::Update) {
+            insertUnique(root, key, [&key](T& stored) {
+                stored = std::move(key);
+                return true;
+            });
+        }
+    }, afterLsn);
+    
+    wal = &log;
+    return records;
+}
+
+template <typename T>
+void BTree<T>::enableFilter() {
+    static_assert(HashableKey<T>, "BTree::enableFilter needs a key type with std::hash");
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    rebuildFilter();
+    filterInstalled.store(true, std::memory_order_release);
+}
+
+template <typename T>
+void BTree<T>::disableFilter() {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    filterInstalled.store(false, std::memory_order_release);
+    filter.store(nullptr, std::memory_order_release);
+}
+
+template <typename T>
+void BTree<T>::enableLookupCache() {
+    static_assert(CacheableKey<T>, "BTree::enableLookupCache needs a hashable, trivially copyable key type");
+    version.fetch_add(1, std::memory_order_release);
+    cacheEnabled.store(true, std::memory_order_release);
+}
+
+template <typename T>
+void BTree<T>::disableLookupCache() {
+    cacheEnabled.store(false, std::memory_order_release);
+}
+
+template <typename T>
+std::size_t BTree<T>::filterCapacity() const {
+    std::shared_ptr<KeyFilter<T>> keyFilter = filter.load(std::memory_order_acquire);
+    return keyFilter ? keyFilter->capacity() : 0;
+}
+
+template <typename T>
+void BTree<T>::enableRedistribution() {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    redistributeOnSplit = true;
+}
+
+template <typename T>
+void BTree<T>::disableRedistribution() {
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    redistributeOnSplit = false;
+}
+
+template <typename T>
+void BTree<T>::enableLazyDelete() {
+    static_assert(std::copy_constructible<T>, "BTree::enableLazyDelete needs copyable keys to remember underfull leaves");
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    lazyDelete = true;
+}
+
+template <typename T>
+void BTree<T>::disableLazyDelete() {
+    {
+        std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+        lazyDelete = false;
+    }
+    compact();
+}
+
+template <typename T>
+bool BTree<T>::lazyDeleteEnabled() const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    return lazyDelete;
+}
+
+template <typename T>
+std::size_t BTree<T>::compact() {
+    std::size_t settled = 0;
+    while (true) {
+        std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+        std::size_t batch = settleUnderfull(COMPACT_BATCH);
+        settled += batch;
+        if (batch < COMPACT_BATCH || underfullKeys.empty()) {
+            return settled;
+        }
+    }
+}
+
+template <typename T>
+std::size_t BTree<T>::pendingRebalances() const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    return underfullKeys.size();
+}
+
+template <typename T>
+void BTree<T>::save(int fd) const {
+    std::shared_lock<ReaderBiasedMutex> lock(tree_mutex);
+    
+    SnapshotHeader header{SNAPSHOT_MAGIC, SNAPSHOT_VERSION, KeyCodec<T>::KEY_SIZE, root ? root->count : 0, 0};
+    header.checksum = snapshotChecksum(reinterpret_cast<const char*>(&header), offsetof(SnapshotHeader, checksum));
+    writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+    
+    std::vector<char> buffer;
+    buffer.reserve(SNAPSHOT_CHUNK_SIZE + sizeof(SnapshotChunk));
+    uint32_t keysInChunk = 0;
+    
+    auto flush = [&]() {
+        SnapshotChunk chunk{static_cast<uint32_t>(buffer.size() - sizeof(SnapshotChunk)), keysInChunk, 0};
+        chunk.checksum = snapshotChecksum(buffer.data() + sizeof(SnapshotChunk), chunk.byteCount);
+        std::memcpy(buffer.data(), &chunk, sizeof(chunk));
+        writeAll(fd, buffer.data(), buffer.size());
+        buffer.assign(sizeof(SnapshotChunk), 0);
+        keysInChunk = 0;
+    };
+    
+    buffer.assign(sizeof(SnapshotChunk), 0);
+    forEachRun(root, [&](const T* keys, std::size_t count) {
+        KeyCodec<T>::encode(keys, count, buffer);
+        keysInChunk += count;
+        if (buffer.size() >= SNAPSHOT_CHUNK_SIZE) {
+            flush();
+        }
+    });
+    
+    if (keysInChunk > 0) {
+        flush();
+    }
+    flush();
+}
+
+template <typename T>
+void BTree<T>::load(int fd) {
+    SnapshotHeader header;
+    if (!readAll(fd, reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != SNAPSHOT_MAGIC) {
+        throw std::runtime_error("BTree::load: not a snapshot");
+    }
+    if (header.checksum != snapshotChecksum(reinterpret_cast<const char*>(&header), offsetof(SnapshotHeader, checksum))) {
+        throw std::runtime_error("BTree::load: snapshot header checksum mismatch");
+    }
+    if (header.version != SNAPSHOT_VERSION || header.keySize != KeyCodec<T>::KEY_SIZE) {
+        throw std::runtime_error("BTree::load: incompatible snapshot version or key type");
+    }
+    
+    std::vector<T> keys;
+    keys.reserve(header.keyCount);
+    std::vector<char> buffer;
+    
+    while (true) {
+        SnapshotChunk chunk;
+        if (!readAll(fd, reinterpret_cast<char*>(&chunk), sizeof(chunk))) {
+            throw std::runtime_error("BTree::load: truncated snapshot");
+        }
+        if (chunk.byteCount == 0) {
             break;
         }
+        
+        buffer.resize(chunk.byteCount);
+        if (!readAll(fd, buffer.data(), buffer.size())) {
+            throw std::runtime_error("BTree::load: truncated snapshot");
+        }
+        if (snapshotChecksum(buffer.data(), buffer.size()) != chunk.checksum) {
+            throw std::runtime_error("BTree::load: checksum mismatch");
+        }
+        
+        if (KeyCodec<T>::decode(buffer.data(), buffer.size(), chunk.keyCount, keys) != buffer.size()) {
+            throw std::runtime_error("BTree::load: malformed chunk");
+        }
     }
     
-    int textLen = text.length() - colorLen;
-    int padding = (termWidth - textLen) / 2;
+    if (keys.size() != header.keyCount) {
+        throw std::runtime_error("BTree::load: key count mismatch");
+    }
+    for (std::size_t i = 1; i < keys.size(); ++i) {
+        if (keys[i] < keys[i - 1]) {
+            throw std::runtime_error("BTree::load: keys are not sorted");
+        }
+    }
     
-    if (padding > 0)
-        std::cout << std::string(padding, ' ');
+    Node* newRoot = buildFromSorted(keys);
     
-    std::cout << text << std::endl;
+    std::unique_lock<ReaderBiasedMutex> lock(tree_mutex);
+    delete root;
+    root = newRoot;
+    dirtyNodes.clear();
+    markAllDirty();
+    onReplaced();
 }
 
-void enableRawMode(struct termios& original) {
-    struct termios raw;
-    tcgetattr(STDIN_FILENO, &original);
-    raw = original;
-    raw.c_lflag &= ~(ICANON | ECHO); 
-    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+template <typename T>
+void BTree<T>::splitChild(Node* parent, int index) {
+    splitChild(parent, index, t - 1);
 }
 
-void disableRawMode(struct termios& original) {
-    tcsetattr(STDIN_FILENO, TCSANOW, &original);
+template <typename T>
+void BTree<T>::splitChild(Node* parent, int index, std::size_t mid) {
+    if (!parent || index < 0 || static_cast<std::size_t>(index) >= parent->children.size()) {
+        return;
+    }
+    
+    Node* y = parent->children[index];
+    if (!y || y->keys.size() < 2*t - 1) {
+        return;
+    }
+    
+    Node* z = new Node(y->isLeaf);
+    shapeEpoch++;
+    
+    parent->keys.insert(parent->keys.begin() + index, std::move(y->keys[mid]));
+    parent->children.insert(parent->children.begin() + index + 1, z);
+    
+    z->keys.assign(std::make_move_iterator(y->keys.begin() + mid + 1), std::make_move_iterator(y->keys.end()));
+    y->keys.erase(y->keys.begin() + mid, y->keys.end());
+    
+    if (!y->isLeaf) {
+        z->children.assign(y->children.begin() + mid + 1, y->children.end());
+        y->children.resize(mid + 1);
+    }
+    
+    z->count = z->keys.size();
+    for (Node* child : z->children) {
+        z->count += child->count;
+    }
+    y->count -= z->count + 1;
+    
+    markDirty(parent);
+    markDirty(y);
+    markDirty(z);
 }
 
-void runSingleTest(void (*testFunc)(), const std::string& testName) {
-    std::cout << "\033c";
-    printFrameTop();
-    printCentered(BOLDWHITE "=== Запуск теста: " + testName + " ===");
-    printFrameBottom();
+template <typename T>
+typename BTree<T>::Path& BTree<T>::edgePath(EdgeHint& hint, bool rightmost) {
+    if (hint.epoch != shapeEpoch || hint.path.depth == 0 || hint.path.entries[0].node != root) {
+        hint.path.depth = 0;
+        for (Node* node = root; ; node = rightmost ? node->children.back() : node->children.front()) {
+            hint.path.push(node, rightmost && !node->isLeaf ? node->children.size() - 1 : 0);
+            if (node->isLeaf) break;
+        }
+        hint.epoch = shapeEpoch;
+    }
+    return hint.path;
+}
+
+template <typename T>
+void BTree<T>::endAppendRun() {
+    appendStreak = 0;
+    if (!spineUnderfull || !root) {
+        return;
+    }
     
-    if (testName == "Финальный стресс-тест" || testName == "Финальный стресс-тест (строки)") {
-        for (float i = 0; i <= 100.0; i += 0.25) {  
-            showProgressBar(i);
-            std::this_thread::sleep_for(std::chrono::milliseconds(30));  
+    spineUnderfull = false;
+    Path& spine = edgePath(rightHint, true);
+    for (int i = spine.depth - 2; i >= 0; --i) {
+        Node* parent = spine.entries[i].node;
+        while (parent->children.size() > 1 && parent->children.back()->keys.size() < minKeys()) {
+            fill(parent, static_cast<int>(parent->children.size()) - 1);
+        }
+    }
+    collapseRoot();
+    shapeEpoch++;
+}
+
+template <typename T>
+const typename BTree<T>::Node* BTree<T>::edgeLeaf(const EdgeHint& hint, bool rightmost) const {
+    if (hint.epoch == shapeEpoch && hint.path.depth > 0 && hint.path.entries[0].node == root) {
+        return hint.path.entries[hint.path.depth - 1].node;
+    }
+    
+    const Node* node = root;
+    while (!node->isLeaf) {
+        node = rightmost ? node->children.back() : node->children.front();
+    }
+    return node;
+}
+
+template <typename T>
+std::optional<T> BTree<T>::popEdge(bool rightmost) {
+    endAppendRun();
+    if (!root || root->count == 0) {
+        return std::nullopt;
+    }
+    
+    Path& spine = edgePath(rightmost ? rightHint : leftHint, rightmost);
+    Path path;
+    for (int i = 0; i + 1 < spine.depth; ++i) {
+        path.push(spine.entries[i].node, spine.entries[i].index);
+        spine.entries[i].node->count--;
+    }
+    
+    Node* leaf = spine.entries[spine.depth - 1].node;
+    auto pos = rightmost ? leaf->keys.end() - 1 : leaf->keys.begin();
+    onRemoved(*pos);
+    std::optional<T> key(std::move(*pos));
+    leaf->keys.erase(pos);
+    leaf->count--;
+    markDirty(leaf);
+    
+    settleRemoval(path, leaf);
+    collapseRoot();
+    return key;
+}
+
+template <typename T>
+void BTree<T>::splitUpward(Path& path, Node* node, Node*& top) {
+    if (node) {
+        BTreeAlgorithms<BTree>::splitUpward(*this, path, node, top);
+    }
+}
+
+template <typename T>
+typename BTree<T>::Node* BTree<T>::growRoot(Node* node) {
+    Node* newRoot = new Node(false);
+    newRoot->children.push_back(node);
+    newRoot->count = node->count;
+    splitChild(newRoot, 0, appending ? node->keys.size() - 2 : t - 1);
+    spineUnderfull = spineUnderfull || appending;
+    return newRoot;
+}
+
+template <typename T>
+bool BTree<T>::absorbOverflow(Node* parent, int index) {
+    if (appending) {
+        splitChild(parent, index, parent->children[index]->keys.size() - 2);
+        spineUnderfull = true;
+    } else if (!redistributeOnSplit) {
+        splitChild(parent, index);
+    } else if (shiftToSibling(parent, index)) {
+        return true;
+    } else {
+        splitThree(parent, index);
+    }
+    return false;
+}
+
+template <typename T>
+bool BTree<T>::shiftToSibling(Node* parent, int index) {
+    Node* node = parent->children[index];
+    Node* left = index > 0 ? parent->children[index - 1] : nullptr;
+    Node* right = static_cast<std::size_t>(index) + 1 < parent->children.size() ? parent->children[index + 1] : nullptr;
+    
+    if (left && left->keys.size() < 2 * t - 1 && (!right || left->keys.size() <= right->keys.size())) {
+        for (std::size_t shift = (node->keys.size() - left->keys.size()) / 2; shift > 0; --shift) {
+            borrowFromNext(parent, index - 1);
+        }
+        return true;
+    }
+    if (right && right->keys.size() < 2 * t - 1) {
+        for (std::size_t shift = (node->keys.size() - right->keys.size()) / 2; shift > 0; --shift) {
+            borrowFromPrev(parent, index + 1);
+        }
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+void BTree<T>::splitThree(Node* parent, int index) {
+    if (parent->children.size() < 2) {
+        splitChild(parent, index);
+        return;
+    }
+    
+    int separator = static_cast<std::size_t>(index) + 1 < parent->children.size() ? index : index - 1;
+    Node* first = parent->children[separator];
+    Node* second = parent->children[separator + 1];
+    Node* third = new Node(first->isLeaf);
+    shapeEpoch++;
+    
+    std::vector<T> keys;
+    keys.reserve(first->keys.size() + second->keys.size() + 1);
+    keys.insert(keys.end(), std::make_move_iterator(first->keys.begin()), std::make_move_iterator(first->keys.end()));
+    keys.push_back(std::move(parent->keys[separator]));
+    keys.insert(keys.end(), std::make_move_iterator(second->keys.begin()), std::make_move_iterator(second->keys.end()));
+    std::vector<Node*> children(first->children);
+    children.insert(children.end(), second->children.begin(), second->children.end());
+    
+    std::size_t firstSize = (keys.size() - 2) / 3;
+    std::size_t secondSize = (keys.size() - 2 - firstSize) / 2;
+    auto from = [&keys](std::size_t begin, std::size_t end) {
+        return std::vector<T>(std::make_move_iterator(keys.begin() + begin), std::make_move_iterator(keys.begin() + end));
+    };
+    
+    first->keys = from(0, firstSize);
+    parent->keys[separator] = std::move(keys[firstSize]);
+    second->keys = from(firstSize + 1, firstSize + 1 + secondSize);
+    parent->keys.insert(parent->keys.begin() + separator + 1, std::move(keys[firstSize + 1 + secondSize]));
+    third->keys = from(firstSize + 2 + secondSize, keys.size());
+    parent->children.insert(parent->children.begin() + separator + 2, third);
+    
+    if (!first->isLeaf) {
+        first->children.assign(children.begin(), children.begin() + firstSize + 1);
+        second->children.assign(children.begin() + firstSize + 1, children.begin() + firstSize + secondSize + 2);
+        third->children.assign(children.begin() + firstSize + secondSize + 2, children.end());
+    }
+    
+    recount(first);
+    recount(second);
+    recount(third);
+    markDirty(parent);
+    markDirty(first);
+    markDirty(second);
+    markDirty(third);
+}
+
+template <typename T>
+template <typename U>
+void BTree<T>::insert(Node* node, U&& key) {
+    if (!node) return;
+    
+    Path path;
+    if (node == root) {
+        Path& spine = edgePath(rightHint, true);
+        Node* leaf = spine.entries[spine.depth - 1].node;
+        if (!leaf->keys.empty() && !(key < leaf->keys.back())) {
+            for (int i = 0; i + 1 < spine.depth; ++i) {
+                path.push(spine.entries[i].node, spine.entries[i].index);
+            }
+            appending = ++appendStreak >= APPEND_STREAK;
+            insertAt(path, leaf, leaf->keys.size(), std::forward<U>(key));
+            appending = false;
+            return;
+        }
+        endAppendRun();
+        node = root;
+    }
+    
+    while (!node->isLeaf) {
+        std::size_t i = findInsertPos(node, key);
+        if (i >= node->children.size() || !node->children[i]) {
+            return;
+        }
+        path.push(node, i);
+        node = node->children[i];
+    }
+    
+    insertAt(path, node, findInsertPos(node, key), std::forward<U>(key));
+}
+
+template <typename T>
+template <typename U, typename F>
+bool BTree<T>::insertUnique(Node* node, U&& key, F&& onExisting) {
+    if (!node) return false;
+    if (node == root) {
+        endAppendRun();
+        node = root;
+    }
+    
+    Path path;
+    while (true) {
+        std::size_t i = findInsertPos(node, key);
+        if (i > 0 && node->keys[i - 1] == key) {
+            if (onExisting(node->keys[i - 1])) {
+                markDirty(node);
+            }
+            return false;
+        }
+        
+        if (node->isLeaf) {
+            insertAt(path, node, i, std::forward<U>(key));
+            return true;
+        }
+        if (i >= node->children.size() || !node->children[i]) {
+            return false;
+        }
+        path.push(node, i);
+        node = node->children[i];
+    }
+}
+
+template <typename T>
+template <typename U>
+void BTree<T>::insertAt(Path& path, Node* leaf, int pos, U&& key) {
+    onInserted(key);
+    leaf->keys.insert(leaf->keys.begin() + pos, std::forward<U>(key));
+    markDirty(leaf);
+    leaf->count++;
+    for (int i = 0; i < path.depth; ++i) {
+        path.entries[i].node->count++;
+    }
+    splitUpward(path, leaf, root);
+}
+
+template <typename T>
+void BTree<T>::mergeNodes(Node* node, int index) {
+    if (!node || index < 0 || static_cast<std::size_t>(index) >= node->children.size() - 1) {
+        return;
+    }
+    
+    Node* child = node->children[index];
+    Node* sibling = node->children[index + 1];
+    
+    if (!child || !sibling) {
+        return;
+    }
+    
+    if (static_cast<std::size_t>(index) < node->keys.size()) {
+        child->count += 1 + sibling->count;
+        child->keys.push_back(std::move(node->keys[index]));
+        
+        child->keys.insert(child->keys.end(), std::make_move_iterator(sibling->keys.begin()),
+                           std::make_move_iterator(sibling->keys.end()));
+        
+        if (!child->isLeaf) {
+            child->children.insert(child->children.end(), sibling->children.begin(), sibling->children.end());
+            sibling->children.clear();
+        }
+        
+        node->keys.erase(node->keys.begin() + index);
+        
+        node->children.erase(node->children.begin() + index + 1);
+        
+        markDirty(node);
+        markDirty(child);
+        dropDirty(sibling);
+        delete sibling;
+        shapeEpoch++;
+    }
+}
+
+template <typename T>
+void BTree<T>::borrowFromPrev(Node* node, int index) {
+    if (!node || index <= 0 || static_cast<std::size_t>(index) >= node->children.size()) {
+        return;
+    }
+    
+    Node* child = node->children[index];
+    Node* sibling = node->children[index - 1];
+    
+    if (!child || !sibling || sibling->keys.empty()) {
+        return;
+    }
+    
+    child->keys.insert(child->keys.begin(), std::move(node->keys[index - 1]));
+    
+    if (static_cast<std::size_t>(index) - 1 < node->keys.size()) {
+        node->keys[index - 1] = std::move(sibling->keys.back());
+        sibling->keys.pop_back();
+        
+        std::size_t moved = 1;
+        if (!child->isLeaf && !sibling->children.empty()) {
+            moved += sibling->children.back()->count;
+            child->children.insert(child->children.begin(), sibling->children.back());
+            sibling->children.pop_back();
+        }
+        child->count += moved;
+        sibling->count -= moved;
+        shapeEpoch++;
+        
+        markDirty(node);
+        markDirty(child);
+        markDirty(sibling);
+    }
+}
+
+template <typename T>
+void BTree<T>::borrowFromNext(Node* node, int index) {
+    if (!node || index < 0 || static_cast<std::size_t>(index) >= node->children.size() - 1 || static_cast<std::size_t>(index) >= node->keys.size()) {
+        return;
+    }
+    
+    Node* child = node->children[index];
+    Node* sibling = node->children[index + 1];
+    
+    if (!child || !sibling || sibling->keys.empty()) {
+        return;
+    }
+    
+    child->keys.push_back(std::move(node->keys[index]));
+    
+    node->keys[index] = std::move(sibling->keys.front());
+    sibling->keys.erase(sibling->keys.begin());
+    
+    std::size_t moved = 1;
+    if (!child->isLeaf && !sibling->children.empty()) {
+        moved += sibling->children.front()->count;
+        child->children.push_back(sibling->children.front());
+        sibling->children.erase(sibling->children.begin());
+    }
+    child->count += moved;
+    sibling->count -= moved;
+    shapeEpoch++;
+    
+    markDirty(node);
+    markDirty(child);
+    markDirty(sibling);
+}
+
+template <typename T>
+void BTree<T>::fill(Node* node, int index) {
+    if (node) {
+        BTreeAlgorithms<BTree>::fill(*this, node, index);
+    }
+}
+
+template <typename T>
+void BTree<T>::rebalanceUpward(Path& path, Node* node) {
+    if (node) {
+        BTreeAlgorithms<BTree>::rebalanceUpward(*this, path, node);
+    }
+}
+
+template <typename T>
+void BTree<T>::settleRemoval(Path& path, Node* node) {
+    if (!lazyDelete) {
+        rebalanceUpward(path, node);
+    } else if (node->keys.empty()) {
+        repairUpward(path);
+    } else if (node->keys.size() < minKeys()) {
+        if constexpr (std::copy_constructible<T>) {
+            underfullKeys.push_back(node->keys.front());
+        }
+    }
+}
+
+template <typename T>
+void BTree<T>::settleLeaf(const T& key) {
+    Path path;
+    while (root && findUnderfullLeaf(root, key, path)) {
+        repairUpward(path);
+        collapseRoot();
+        path.depth = 0;
+    }
+}
+
+template <typename T>
+bool BTree<T>::findUnderfullLeaf(Node* node, const T& key, Path& path) {
+    if (node->isLeaf) {
+        return node != root && node->keys.size() < minKeys();
+    }
+    
+    std::size_t last = findInsertPos(node, key);
+    for (std::size_t i = findKey(node, key); i <= last; ++i) {
+        path.push(node, i);
+        if (findUnderfullLeaf(node->children[i], key, path)) {
+            return true;
+        }
+        path.pop();
+    }
+    return false;
+}
+
+template <typename T>
+void BTree<T>::repairUpward(Path& path) {
+    while (!path.empty()) {
+        PathEntry entry = path.pop();
+        repairChild(entry.node, entry.index);
+        if (entry.node->keys.size() >= minKeys()) {
+            break;
+        }
+    }
+}
+
+template <typename T>
+std::size_t BTree<T>::settleUnderfull(std::size_t limit) {
+    endAppendRun();
+    std::size_t settled = 0;
+    for (; settled < limit && !underfullKeys.empty(); ++settled) {
+        T key = std::move(underfullKeys.back());
+        underfullKeys.pop_back();
+        settleLeaf(key);
+    }
+    if (settled > 0) {
+        shapeEpoch++;
+    }
+    return settled;
+}
+
+template <typename T>
+std::size_t BTree<T>::keyCount(Node* node) const {
+    return node->keys.size();
+}
+
+template <typename T>
+const T& BTree<T>::keyAt(Node* node, std::size_t index) const {
+    return node->keys[index];
+}
+
+template <typename T>
+typename BTree<T>::Node* BTree<T>::childAt(Node* node, std::size_t index) const {
+    return node->children[index];
+}
+
+template <typename T>
+bool BTree<T>::isLeaf(Node* node) const {
+    return node->isLeaf;
+}
+
+template <typename T>
+std::size_t BTree<T>::maxKeys() const {
+    return 2 * t - 1;
+}
+
+template <typename T>
+std::size_t BTree<T>::minKeys() const {
+    return t - 1;
+}
+
+template <typename T>
+template <typename K>
+std::size_t BTree<T>::findKey(Node* node, const K& key) const {
+    return node ? BTreeAlgorithms<BTree>::findKey(*this, node, key) : 0;
+}
+
+template <typename T>
+template <typename K>
+std::size_t BTree<T>::findInsertPos(Node* node, const K& key) const {
+    return node ? BTreeAlgorithms<BTree>::findInsertPos(*this, node, key) : 0;
+}
+
+template <typename T>
+template <typename K>
+bool BTree<T>::remove(Node* node, const K& key) {
+    return remove(node, key, [](T&) { return true; });
+}
+
+template <typename T>
+template <typename K, typename F>
+bool BTree<T>::remove(Node* node, const K& key, F&& shouldErase) {
+    if (node && node == root) {
+        endAppendRun();
+        node = root;
+    }
+    
+    Path path;
+    std::size_t index = 0;
+    
+    while (true) {
+        if (!node) {
+            return false;
+        }
+        
+        index = findKey(node, key);
+        if (index < node->keys.size() && key == node->keys[index]) {
+            break;
+        }
+        
+        if (node->isLeaf || index >= node->children.size()) {
+            return false;
+        }
+        
+        path.push(node, index);
+        node = node->children[index];
+    }
+    
+    if (!shouldErase(node->keys[index])) {
+        markDirty(node);
+        onUpdated(node->keys[index]);
+        return true;
+    }
+    
+    onRemoved(node->keys[index]);
+    node->count--;
+    for (int i = 0; i < path.depth; ++i) {
+        path.entries[i].node->count--;
+    }
+    
+    markDirty(node);
+    if (node->isLeaf) {
+        node->keys.erase(node->keys.begin() + index);
+    } else {
+        Node* leaf = node->children[index];
+        path.push(node, index);
+        leaf->count--;
+        while (!leaf->isLeaf) {
+            path.push(leaf, leaf->children.size() - 1);
+            leaf = leaf->children.back();
+            leaf->count--;
+        }
+        
+        node->keys[index] = std::move(leaf->keys.back());
+        leaf->keys.pop_back();
+        markDirty(leaf);
+        node = leaf;
+    }
+    
+    settleRemoval(path, node);
+    return true;
+}
+
+template <typename T>
+template <typename K>
+std::size_t BTree<T>::rank(Node* node, const K& key, bool inclusive) const {
+    std::size_t result = 0;
+    
+    while (node) {
+        std::size_t i = inclusive ? findInsertPos(node, key) : findKey(node, key);
+        result += i;
+        
+        if (node->isLeaf || i >= node->children.size()) {
+            break;
+        }
+        
+        for (std::size_t j = 0; j < i; ++j) {
+            result += node->children[j]->count;
+        }
+        node = node->children[i];
+    }
+    
+    return result;
+}
+
+template <typename T>
+template <typename F>
+void BTree<T>::forEachRun(Node* node, F&& fn) const {
+    if (!node) return;
+    
+    Path path;
+    path.push(node, 0);
+    while (!path.empty()) {
+        PathEntry& top = path.entries[path.depth - 1];
+        Node* current = top.node;
+        
+        if (current->isLeaf) {
+            fn(current->keys.data(), current->keys.size());
+            path.pop();
+            continue;
+        }
+        
+        if (static_cast<std::size_t>(top.index) > current->keys.size()) {
+            path.pop();
+            continue;
+        }
+        
+        int i = top.index++;
+        if (i > 0) {
+            fn(&current->keys[i - 1], 1);
+        }
+        path.push(current->children[i], 0);
+    }
+}
+
+template <typename T>
+std::vector<typename BTree<T>::Partition> BTree<T>::partition(std::size_t target) const {
+    std::vector<Partition> parts;
+    if (!root || root->keys.empty()) return parts;
+    
+    parts.push_back({root, nullptr});
+    std::size_t subtrees = 1;
+    while (subtrees < target) {
+        std::vector<Partition> next;
+        bool expanded = false;
+        for (const Partition& part : parts) {
+            if (!part.subtree || part.subtree->isLeaf) {
+                next.push_back(part);
+                continue;
+            }
+            
+            Node* node = part.subtree;
+            for (std::size_t i = 0; i < node->keys.size(); ++i) {
+                next.push_back({node->children[i], nullptr});
+                next.push_back({nullptr, &node->keys[i]});
+            }
+            next.push_back({node->children.back(), nullptr});
+            expanded = true;
+        }
+        if (!expanded) break;
+        
+        parts = std::move(next);
+        subtrees = std::count_if(parts.begin(), parts.end(), [](const Partition& part) { return part.subtree; });
+    }
+    return parts;
+}
+
+template <typename T>
+typename BTree<T>::Node* BTree<T>::buildFromSorted(std::vector<T>& keys) {
+    std::vector<std::size_t> capacity;
+    std::size_t fanout = 2 * t;
+    std::size_t maxKeys = fanout - 1;
+    capacity.push_back(maxKeys);
+    
+    while (maxKeys < keys.size()) {
+        maxKeys = maxKeys > (SIZE_MAX - fanout + 1) / fanout ? SIZE_MAX : maxKeys * fanout + fanout - 1;
+        capacity.push_back(maxKeys);
+    }
+    
+    return buildFromSorted(keys, 0, keys.size(), capacity, capacity.size() - 1, true);
+}
+
+template <typename T>
+typename BTree<T>::Node* BTree<T>::buildFromSorted(std::vector<T>& keys, std::size_t begin, std::size_t end,
+                                                   const std::vector<std::size_t>& capacity, int height, bool isRoot) {
+    std::size_t n = end - begin;
+    Node* node = new Node(height == 0);
+    node->count = n;
+    
+    if (height == 0) {
+        node->keys.assign(std::make_move_iterator(keys.begin() + begin), std::make_move_iterator(keys.begin() + end));
+        return node;
+    }
+    
+    std::size_t childCapacity = capacity[height - 1];
+    std::size_t childCount = n / (childCapacity + 1) + 1;
+    childCount = std::max<std::size_t>(childCount, isRoot ? 2 : t);
+    
+    std::size_t childKeys = n - (childCount - 1);
+    std::size_t base = childKeys / childCount;
+    std::size_t extra = childKeys % childCount;
+    
+    node->keys.reserve(childCount - 1);
+    node->children.reserve(childCount);
+    
+    std::size_t pos = begin;
+    for (std::size_t i = 0; i < childCount; ++i) {
+        std::size_t size = base + (i < extra ? 1 : 0);
+        node->children.push_back(buildFromSorted(keys, pos, pos + size, capacity, height - 1, false));
+        pos += size;
+        if (i + 1 < childCount) {
+            node->keys.push_back(std::move(keys[pos]));
+            pos++;
+        }
+    }
+    
+    return node;
+}
+
+template <typename T>
+void BTree<T>::onInserted(const T& key) {
+    version.fetch_add(1, std::memory_order_release);
+    if constexpr (CodecKey<T>) {
+        if (wal) {
+            wal->append(WriteAheadLog<T>::Operation::Insert, key);
+        }
+    }
+    if constexpr (HashableKey<T>) {
+        if (filterInstalled.load(std::memory_order_relaxed)) {
+            filter.load(std::memory_order_acquire)->add(key);
+        }
+    }
+}
+
+template <typename T>
+void BTree<T>::onRemoved(const T& key) {
+    version.fetch_add(1, std::memory_order_release);
+    if constexpr (CodecKey<T>) {
+        if (wal) {
+            wal->append(WriteAheadLog<T>::Operation::Remove, key);
+        }
+    }
+    if constexpr (HashableKey<T>) {
+        if (filterInstalled.load(std::memory_order_relaxed)) {
+            filter.load(std::memory_order_acquire)->remove(key);
+        }
+    }
+}
+
+template <typename T>
+void BTree<T>::onUpdated(const T& key) {
+    version.fetch_add(1, std::memory_order_release);
+    if constexpr (CodecKey<T>) {
+        if (wal) {
+            wal->append(WriteAheadLog<T>::Operation::Update, key);
+        }
+    }
+}
+
+template <typename T>
+void BTree<T>::waitForLog(std::unique_lock<ReaderBiasedMutex>& lock) {
+    if (root) {
+        edgePath(leftHint, false);
+        edgePath(rightHint, true);
+    }
+    if (filterInstalled.load(std::memory_order_relaxed) &&
+        (filterStale.load(std::memory_order_relaxed) || filter.load(std::memory_order_relaxed)->degraded())) {
+        rebuildFilter();
+    }
+    
+    WriteAheadLog<T>* log = wal;
+    uint64_t lsn = log ? log->lastLsn() : 0;
+    lock.unlock();
+    if (log) {
+        log->waitDurable(lsn);
+    }
+}
+
+template <typename T>
+void BTree<T>::rebuildFilter() {
+    if constexpr (HashableKey<T>) {
+        std::size_t keyCount = root ? root->count : 0;
+        auto keyFilter = std::make_shared<KeyFilter<T>>(std::max(KeyFilter<T>::MIN_CAPACITY, 2 * keyCount));
+        forEachRun(root, [&keyFilter](const T* keys, std::size_t count) {
+            for (std::size_t i = 0; i < count; ++i) {
+                keyFilter->add(keys[i]);
+            }
+        });
+        
+        filter.store(std::move(keyFilter), std::memory_order_release);
+        filterStale.store(false, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+void BTree<T>::onReplaced() {
+    version.fetch_add(1, std::memory_order_release);
+    shapeEpoch++;
+    if (filterInstalled.load(std::memory_order_relaxed)) {
+        rebuildFilter();
+    }
+}
+
+template <typename T>
+std::array<typename BTree<T>::CacheSlot, BTree<T>::CACHE_SLOTS>& BTree<T>::lookupCache() {
+    static thread_local std::array<CacheSlot, CACHE_SLOTS> cache{};
+    return cache;
+}
+
+template <typename T>
+template <typename K>
+const T* BTree<T>::locate(const K& key) const {
+    if (!root) {
+        return nullptr;
+    }
+    
+    std::size_t pos;
+    Node* node = BTreeAlgorithms<BTree>::find(*this, root, key, pos);
+    return node ? &node->keys[pos] : nullptr;
+}
+
+template <typename T>
+void BTree<T>::markDirty(Node* node) {
+    if (checkpointEpoch != 0 && node->dirtyEpoch != checkpointEpoch) {
+        node->dirtyEpoch = checkpointEpoch;
+        dirtyNodes.insert(node);
+    }
+}
+
+template <typename T>
+void BTree<T>::dropDirty(Node* node) {
+    if (checkpointEpoch != 0 && node->dirtyEpoch == checkpointEpoch) {
+        dirtyNodes.erase(node);
+    }
+}
+
+template <typename T>
+void BTree<T>::markAllDirty() {
+    if (checkpointEpoch == 0 || !root) {
+        return;
+    }
+    
+    std::vector<Node*> stack{root};
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        node->dirtyEpoch = checkpointEpoch;
+        dirtyNodes.insert(node);
+        stack.insert(stack.end(), node->children.begin(), node->children.end());
+    }
+}
+
+template <typename T>
+void BTree<T>::collapseRoot() {
+    if (root->keys.empty() && !root->isLeaf && !root->children.empty()) {
+        Node* oldRoot = root;
+        root = root->children[0];
+        shapeEpoch++;
+        
+        oldRoot->children.clear();
+        dropDirty(oldRoot);
+        delete oldRoot;
+    }
+}
+
+template <typename T>
+int BTree<T>::height(Node* node) const {
+    if (!node) return -1;
+    
+    int h = 0;
+    while (!node->isLeaf) {
+        node = node->children[0];
+        h++;
+    }
+    return h;
+}
+
+template <typename T>
+void BTree<T>::recount(Node* node) {
+    node->count = node->keys.size();
+    for (Node* child : node->children) {
+        node->count += child->count;
+    }
+}
+
+template <typename T>
+void BTree<T>::repairChild(Node* parent, int index) {
+    while (parent->children.size() > 1 && parent->children[index]->keys.size() < t - 1) {
+        std::size_t before = parent->children.size();
+        fill(parent, index);
+        if (parent->children.size() < before) {
+            return;
+        }
+    }
+}
+
+template <typename T>
+typename BTree<T>::Node* BTree<T>::trimRoot(Node* node) {
+    while (node && node->keys.empty()) {
+        Node* child = node->isLeaf ? nullptr : node->children[0];
+        node->children.clear();
+        dropDirty(node);
+        delete node;
+        shapeEpoch++;
+        node = child;
+    }
+    return node;
+}
+
+template <typename T>
+typename BTree<T>::Node* BTree<T>::joinNodes(Node* left, T&& separator, Node* right) {
+    int leftHeight = height(left);
+    int rightHeight = height(right);
+    
+    if (leftHeight == rightHeight) {
+        Node* top = new Node(left == nullptr);
+        top->keys.push_back(std::move(separator));
+        if (left) {
+            top->children = {left, right};
+            repairChild(top, 0);
+            if (top->children.size() > 1) {
+                repairChild(top, 1);
+            }
+        }
+        recount(top);
+        markDirty(top);
+        return trimRoot(top);
+    }
+    
+    Path path;
+    Node* top = leftHeight > rightHeight ? left : right;
+    Node* node = top;
+    std::size_t added = 1 + (leftHeight > rightHeight ? (right ? right->count : 0) : (left ? left->count : 0));
+    for (int h = std::max(leftHeight, rightHeight); h > std::min(leftHeight, rightHeight) + 1; --h) {
+        node->count += added;
+        int i = leftHeight > rightHeight ? node->children.size() - 1 : 0;
+        path.push(node, i);
+        node = node->children[i];
+    }
+    
+    node->count += added;
+    if (leftHeight > rightHeight) {
+        node->keys.push_back(std::move(separator));
+        if (right) {
+            node->children.push_back(right);
+            repairChild(node, node->children.size() - 1);
+        }
+    } else {
+        node->keys.insert(node->keys.begin(), std::move(separator));
+        if (left) {
+            node->children.insert(node->children.begin(), left);
+            repairChild(node, 0);
+        }
+    }
+    markDirty(node);
+    
+    splitUpward(path, node, top);
+    return top;
+}
+
+template <typename T>
+typename BTree<T>::Node* BTree<T>::concatNodes(Node* left, Node* right) {
+    if (!left || !right) {
+        return left ? left : right;
+    }
+    
+    Path path;
+    Node* node = right;
+    while (!node->isLeaf) {
+        node->count--;
+        path.push(node, 0);
+        node = node->children[0];
+    }
+    
+    T separator = std::move(node->keys.front());
+    node->keys.erase(node->keys.begin());
+    node->count--;
+    markDirty(node);
+    rebalanceUpward(path, node);
+    
+    return joinNodes(left, std::move(separator), trimRoot(right));
+}
+
+template <typename T>
+template <typename K>
+std::pair<typename BTree<T>::Node*, typename BTree<T>::Node*> BTree<T>::splitNodes(Node* node, const K& key, bool inclusive) {
+    if (!node) {
+        return {nullptr, nullptr};
+    }
+    
+    std::size_t i = inclusive ? findInsertPos(node, key) : findKey(node, key);
+    if (node->isLeaf) {
+        Node* right = new Node(true);
+        right->keys.assign(std::make_move_iterator(node->keys.begin() + i), std::make_move_iterator(node->keys.end()));
+        node->keys.erase(node->keys.begin() + i, node->keys.end());
+        recount(node);
+        recount(right);
+        markDirty(node);
+        markDirty(right);
+        return {trimRoot(node), trimRoot(right)};
+    }
+    
+    auto [subLeft, subRight] = splitNodes(node->children[i], key, inclusive);
+    
+    Node* right = subRight;
+    if (i < node->keys.size()) {
+        Node* rest = new Node(false);
+        rest->keys.assign(std::make_move_iterator(node->keys.begin() + i + 1), std::make_move_iterator(node->keys.end()));
+        rest->children.assign(node->children.begin() + i + 1, node->children.end());
+        recount(rest);
+        markDirty(rest);
+        right = joinNodes(subRight, std::move(node->keys[i]), trimRoot(rest));
+        node->keys.erase(node->keys.begin() + i, node->keys.end());
+    }
+    node->children.erase(node->children.begin() + i, node->children.end());
+    
+    Node* left = subLeft;
+    if (i > 0) {
+        T separator = std::move(node->keys.back());
+        node->keys.pop_back();
+        recount(node);
+        markDirty(node);
+        left = joinNodes(trimRoot(node), std::move(separator), subLeft);
+    } else {
+        dropDirty(node);
+        delete node;
+    }
+    
+    return {left, right};
+}
+
+template <typename T>
+void BTree<T>::adoptNodes(Node* piece, BTree& from) {
+    from.version.fetch_add(1, std::memory_order_release);
+    version.fetch_add(1, std::memory_order_release);
+    from.shapeEpoch++;
+    shapeEpoch++;
+    if (!piece) return;
+    
+    if (checkpointEpoch != 0 || from.checkpointEpoch != 0) {
+        std::vector<Node*> stack{piece};
+        while (!stack.empty()) {
+            Node* node = stack.back();
+            stack.pop_back();
+            from.dropDirty(node);
+            node->dirtyEpoch = 0;
+            markDirty(node);
+            stack.insert(stack.end(), node->children.begin(), node->children.end());
+        }
+    }
+    
+    if (wal || from.wal || filterInstalled.load(std::memory_order_relaxed) || from.filterInstalled.load(std::memory_order_relaxed)) {
+        forEachRun(piece, [this, &from](const T* run, std::size_t count) {
+            for (std::size_t i = 0; i < count; ++i) {
+                from.onRemoved(run[i]);
+                onInserted(run[i]);
+            }
+        });
+    }
+}
+
+template <typename T>
+const T& BTree<T>::edgeKey(Node* node, bool rightmost) {
+    while (!node->isLeaf) {
+        node = rightmost ? node->children.back() : node->children.front();
+    }
+    return rightmost ? node->keys.back() : node->keys.front();
+}
+
+template <typename T>
+void BTree<T>::releaseNodes(Node* node) {
+    if (!node) return;
+    
+    std::vector<Node*> stack{node};
+    std::vector<void*> blocks;
+    while (!stack.empty()) {
+        Node* current = stack.back();
+        stack.pop_back();
+        stack.insert(stack.end(), current->children.begin(), current->children.end());
+        current->children.clear();
+        dropDirty(current);
+        current->~Node();
+        blocks.push_back(current);
+    }
+    SubAllocator::instance().deallocate(blocks);
+}
+
+template <typename T>
+void BTree<T>::traverse(Node* node) const {
+    if (!node) return;
+    
+    int i;
+    for (i = 0; i < node->keys.size(); i++) {
+        if (!node->isLeaf && i < node->children.size() && node->children[i]) {
+            traverse(node->children[i]);
+        }
+        std::cout << node->keys[i] << " ";
+    }
+    
+    if (!node->isLeaf && i < node->children.size() && node->children[i]) {
+        traverse(node->children[i]);
+    }
+}
+
+template <typename T>
+Checkpointer<T>::Checkpointer(BTree<T>& tree, const std::string& path, WriteAheadLog<T>* log,
+                              std::chrono::milliseconds interval)
+    : tree_(tree), path_(path), log_(log), interval_(interval), fd_(-1), fileBytes_(0), liveBytes_(0),
+      lastRoot_(0), stopping_(false) {
+    restore();
+    checkpoint();
+    worker_ = std::thread(&Checkpointer::run, this);
+}
+
+template <typename T>
+Checkpointer<T>::~Checkpointer() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    worker_.join();
+    
+    {
+        std::unique_lock<ReaderBiasedMutex> lock(tree_.tree_mutex);
+        tree_.checkpointEpoch = 0;
+        tree_.dirtyNodes.clear();
+    }
+    ::close(fd_);
+}
+
+template <typename T>
+std::size_t Checkpointer<T>::checkpoint() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    
+    std::vector<char> buffer;
+    std::size_t written = 0;
+    uint64_t lsn = 0;
+    while (true) {
+        std::unique_lock<ReaderBiasedMutex> lock(tree_.tree_mutex);
+        uint64_t rootId = reinterpret_cast<uintptr_t>(tree_.root);
+        if (tree_.dirtyNodes.empty()) {
+            if (written == 0 && rootId == lastRoot_) {
+                return 0;
+            }
+            
+            lsn = log_ ? log_->lastLsn() : 0;
+            std::size_t start = buffer.size();
+            buffer.resize(start + sizeof(RecordHeader) + sizeof(lsn));
+            std::memcpy(buffer.data() + start + sizeof(RecordHeader), &lsn, sizeof(lsn));
+            sealRecord(buffer, start, CommitRecord, 0, rootId);
+            lastRoot_ = rootId;
+            break;
+        }
+        
+        auto it = tree_.dirtyNodes.begin();
+        for (std::size_t i = 0; i < CHECKPOINT_BATCH && it != tree_.dirtyNodes.end(); ++i, ++written) {
+            appendNode(buffer, *it);
+            (*it)->dirtyEpoch = 0;
+            it = tree_.dirtyNodes.erase(it);
+        }
+    }
+    
+    try {
+        writeAll(fd_, buffer.data(), buffer.size());
+        if (fdatasync(fd_) != 0) {
+            throw std::system_error(errno, std::generic_category(), "Checkpointer: cannot sync " + path_);
+        }
+    } catch (...) {
+        if (ftruncate(fd_, fileBytes_) != 0) {
+            std::cerr << RED "Checkpointer: cannot roll back a failed checkpoint" RESET << std::endl;
+        }
+        std::unique_lock<ReaderBiasedMutex> lock(tree_.tree_mutex);
+        tree_.markAllDirty();
+        lastRoot_ = 0;
+        throw;
+    }
+    fileBytes_ += buffer.size();
+    
+    if (log_) {
+        log_->truncate(lsn);
+    }
+    if (fileBytes_ > 2 * liveBytes_ + COMPACTION_SLACK) {
+        compact();
+    }
+    return written;
+}
+
+template <typename T>
+uint64_t Checkpointer<T>::fileSize() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return fileBytes_;
+}
+
+template <typename T>
+void Checkpointer<T>::run() {
+    std::unique_lock<std::mutex> lock(stateMutex_);
+    while (!wake_.wait_for(lock, interval_, [this] { return stopping_; })) {
+        lock.unlock();
+        try {
+            checkpoint();
+        } catch (const std::exception& e) {
+            std::cerr << RED "Checkpointer: " << e.what() << RESET << std::endl;
+        }
+        lock.lock();
+    }
+}
+
+template <typename T>
+void Checkpointer<T>::restore() {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "Checkpointer: cannot open " + path_);
+    }
+    
+    uint64_t lsn = 0;
+    if (lseek(fd_, 0, SEEK_END) == 0) {
+        FileHeader header{MAGIC, VERSION, KeyCodec<T>::KEY_SIZE};
+        writeAll(fd_, reinterpret_cast<const char*>(&header), sizeof(header));
+        fdatasync(fd_);
+        fileBytes_ = liveBytes_ = sizeof(header);
+    } else {
+        std::vector<char> data = readFile();
+        Image image = parse(data);
+        if (image.end != data.size() && ftruncate(fd_, image.end) != 0) {
+            throw std::system_error(errno, std::generic_category(), "Checkpointer: cannot cut torn tail");
+        }
+        fileBytes_ = image.end;
+        liveBytes_ = sizeof(FileHeader);
+        
+        if (image.committed) {
+            Node* newRoot = image.root ? restoreNode(data, image, image.root, 0) : new Node(true);
+            std::unique_lock<ReaderBiasedMutex> lock(tree_.tree_mutex);
+            delete tree_.root;
+            tree_.root = newRoot;
+        }
+        lsn = image.lsn;
+    }
+    
+    if (log_) {
+        tree_.recover(*log_, lsn);
+    }
+    
+    std::unique_lock<ReaderBiasedMutex> lock(tree_.tree_mutex);
+    tree_.onReplaced();
+    tree_.checkpointEpoch = 1;
+    tree_.dirtyNodes.clear();
+    tree_.markAllDirty();
+}
+
+template <typename T>
+void Checkpointer<T>::compact() {
+    std::vector<char> data = readFile();
+    Image image = parse(data);
+    
+    FileHeader header{MAGIC, VERSION, KeyCodec<T>::KEY_SIZE};
+    std::vector<char> out(reinterpret_cast<const char*>(&header), reinterpret_cast<const char*>(&header) + sizeof(header));
+    
+    std::vector<uint64_t> stack;
+    if (image.root) {
+        stack.push_back(image.root);
+    }
+    while (!stack.empty()) {
+        auto it = image.nodes.find(stack.back());
+        stack.pop_back();
+        if (it == image.nodes.end()) {
+            throw std::runtime_error("Checkpointer: checkpoint references a missing node");
+        }
+        
+        RecordHeader record;
+        std::memcpy(&record, data.data() + it->second, sizeof(record));
+        const char* begin = data.data() + it->second;
+        out.insert(out.end(), begin, begin + sizeof(record) + record.byteCount);
+        
+        if (record.kind == InnerRecord) {
+            const char* children = begin + sizeof(record) + record.byteCount - (record.keyCount + 1) * sizeof(uint64_t);
+            for (uint32_t i = 0; i <= record.keyCount; ++i) {
+                uint64_t child;
+                std::memcpy(&child, children + i * sizeof(child), sizeof(child));
+                stack.push_back(child);
+            }
+        }
+    }
+    
+    std::size_t start = out.size();
+    out.resize(start + sizeof(RecordHeader) + sizeof(image.lsn));
+    std::memcpy(out.data() + start + sizeof(RecordHeader), &image.lsn, sizeof(image.lsn));
+    sealRecord(out, start, CommitRecord, 0, image.root);
+    
+    std::string tempPath = path_ + ".tmp";
+    int tempFd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tempFd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Checkpointer: cannot create " + tempPath);
+    }
+    try {
+        writeAll(tempFd, out.data(), out.size());
+    } catch (...) {
+        ::close(tempFd);
+        throw;
+    }
+    bool ok = fdatasync(tempFd) == 0;
+    ::close(tempFd);
+    if (!ok || ::rename(tempPath.c_str(), path_.c_str()) != 0 || !syncDirectoryOf(path_)) {
+        throw std::system_error(errno, std::generic_category(), "Checkpointer: cannot replace " + path_);
+    }
+    
+    int newFd = ::open(path_.c_str(), O_RDWR | O_APPEND);
+    if (newFd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Checkpointer: cannot reopen " + path_);
+    }
+    ::close(fd_);
+    fd_ = newFd;
+    fileBytes_ = liveBytes_ = out.size();
+}
+
+template <typename T>
+std::vector<char> Checkpointer<T>::readFile() const {
+    off_t end = lseek(fd_, 0, SEEK_END);
+    std::vector<char> data(end);
+    if (pread(fd_, data.data(), data.size(), 0) != static_cast<ssize_t>(data.size())) {
+        throw std::system_error(errno, std::generic_category(), "Checkpointer: cannot read " + path_);
+    }
+    return data;
+}
+
+template <typename T>
+typename Checkpointer<T>::Image Checkpointer<T>::parse(const std::vector<char>& data) const {
+    FileHeader header;
+    if (data.size() < sizeof(header)) {
+        throw std::runtime_error("Checkpointer: " + path_ + " is not a checkpoint file");
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != MAGIC || header.version != VERSION || header.keySize != KeyCodec<T>::KEY_SIZE) {
+        throw std::runtime_error("Checkpointer: " + path_ + " is not a compatible checkpoint file");
+    }
+    
+    Image image;
+    std::unordered_map<uint64_t, std::size_t> pending;
+    std::size_t offset = sizeof(header);
+    
+    while (data.size() - offset >= sizeof(RecordHeader)) {
+        RecordHeader record;
+        std::memcpy(&record, data.data() + offset, sizeof(record));
+        const char* payload = data.data() + offset + sizeof(record);
+        if (record.byteCount > data.size() - offset - sizeof(record) || recordChecksum(record, payload) != record.checksum) {
+            break;
+        }
+        
+        if (record.kind == CommitRecord) {
+            for (const auto& entry : pending) {
+                image.nodes[entry.first] = entry.second;
+            }
+            pending.clear();
+            image.root = record.id;
+            std::memcpy(&image.lsn, payload, sizeof(image.lsn));
+            image.committed = true;
+            image.end = offset + sizeof(record) + record.byteCount;
+        } else {
+            pending[record.id] = offset;
+        }
+        offset += sizeof(record) + record.byteCount;
+    }
+    
+    return image;
+}
+
+template <typename T>
+typename Checkpointer<T>::Node* Checkpointer<T>::restoreNode(const std::vector<char>& data, const Image& image,
+                                                             uint64_t id, int depth) const {
+    auto it = image.nodes.find(id);
+    if (depth >= BTree<T>::MAX_HEIGHT || it == image.nodes.end()) {
+        throw std::runtime_error("Checkpointer: checkpoint references a missing node");
+    }
+    
+    RecordHeader record;
+    std::memcpy(&record, data.data() + it->second, sizeof(record));
+    const char* payload = data.data() + it->second + sizeof(record);
+    bool leaf = record.kind == LeafRecord;
+    
+    std::vector<T> keys;
+    keys.reserve(record.keyCount);
+    std::size_t used = KeyCodec<T>::decode(payload, record.byteCount, record.keyCount, keys);
+    std::size_t childBytes = leaf ? 0 : (record.keyCount + std::size_t(1)) * sizeof(uint64_t);
+    if (keys.size() != record.keyCount || used + childBytes != record.byteCount) {
+        throw std::runtime_error("Checkpointer: malformed node record");
+    }
+    
+    Node* node = new Node(leaf);
+    node->keys = std::move(keys);
+    node->count = node->keys.size();
+    try {
+        for (uint32_t i = 0; !leaf && i <= record.keyCount; ++i) {
+            uint64_t child;
+            std::memcpy(&child, payload + used + i * sizeof(child), sizeof(child));
+            node->children.push_back(restoreNode(data, image, child, depth + 1));
+            node->count += node->children.back()->count;
+        }
+    } catch (...) {
+        delete node;
+        throw;
+    }
+    return node;
+}
+
+template <typename T>
+void Checkpointer<T>::appendNode(std::vector<char>& out, const Node* node) const {
+    std::size_t start = out.size();
+    out.resize(start + sizeof(RecordHeader));
+    KeyCodec<T>::encode(node->keys.data(), node->keys.size(), out);
+    
+    for (const Node* child : node->children) {
+        uint64_t id = reinterpret_cast<uintptr_t>(child);
+        out.insert(out.end(), reinterpret_cast<const char*>(&id), reinterpret_cast<const char*>(&id) + sizeof(id));
+    }
+    
+    sealRecord(out, start, node->isLeaf ? LeafRecord : InnerRecord, node->keys.size(), reinterpret_cast<uintptr_t>(node));
+}
+
+template <typename T>
+void Checkpointer<T>::sealRecord(std::vector<char>& out, std::size_t start, uint32_t kind, uint32_t keyCount, uint64_t id) {
+    RecordHeader record{kind, keyCount, id, out.size() - start - sizeof(RecordHeader), 0};
+    record.checksum = recordChecksum(record, out.data() + start + sizeof(RecordHeader));
+    std::memcpy(out.data() + start, &record, sizeof(record));
+}
+
+template <typename T>
+uint64_t Checkpointer<T>::recordChecksum(const RecordHeader& record, const char* payload) {
+    return snapshotChecksum(reinterpret_cast<const char*>(&record), offsetof(RecordHeader, checksum)) ^
+           std::rotl(snapshotChecksum(payload, record.byteCount), 1);
+}
+
+template <typename T>
+NodeCompactor<T>::NodeCompactor(BTree<T>& tree, std::chrono::milliseconds interval)
+    : tree_(tree), interval_(interval), stopping_(false), ownsLazyDelete_(!tree.lazyDeleteEnabled()) {
+    tree_.enableLazyDelete();
+    worker_ = std::thread(&NodeCompactor::run, this);
+}
+
+template <typename T>
+NodeCompactor<T>::~NodeCompactor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    worker_.join();
+    if (ownsLazyDelete_) {
+        tree_.disableLazyDelete();
+    }
+}
+
+template <typename T>
+void NodeCompactor<T>::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!wake_.wait_for(lock, interval_, [this] { return stopping_; })) {
+        lock.unlock();
+        if (tree_.pendingRebalances() > 0) {
+            tree_.compact();
+        }
+        lock.lock();
+    }
+}
+
+template <typename T>
+PackedIndex<T>::PackedIndex(const BTree<T>& tree) {
+    std::shared_lock<ReaderBiasedMutex> lock(tree.tree_mutex);
+    
+    std::array<T, BLOCK_KEYS> buffer;
+    std::size_t filled = 0;
+    tree.forEachRun(tree.root, [&](const T* keys, std::size_t count) {
+        while (count > 0) {
+            std::size_t take = std::min(count, BLOCK_KEYS - filled);
+            std::copy(keys, keys + take, buffer.begin() + filled);
+            filled += take;
+            keys += take;
+            count -= take;
+            if (filled == BLOCK_KEYS) {
+                append(buffer.data(), filled);
+                filled = 0;
+            }
+        }
+    });
+    
+    if (filled > 0) {
+        append(buffer.data(), filled);
+    }
+}
+
+template <typename T>
+bool PackedIndex<T>::search(T key) const {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    if (blocks.empty() || key < blocks.front().base) {
+        return false;
+    }
+    
+    const Block& block = blocks[findBlock(key)];
+    Delta target = static_cast<Delta>(key) - static_cast<Delta>(block.base);
+    std::size_t lo = 0;
+    std::size_t hi = block.count;
+    while (lo < hi) {
+        std::size_t mid = (lo + hi) / 2;
+        if (extract(block, mid) < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return lo < block.count && extract(block, lo) == target;
+}
+
+template <typename T>
+void PackedIndex<T>::insert(T key) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    if (blocks.empty()) {
+        blocks.push_back(pack(&key, 1));
+        keyCount++;
+        return;
+    }
+    
+    std::size_t index = findBlock(key);
+    Block& block = blocks[index];
+    std::array<T, BLOCK_KEYS + 1> keys;
+    unpack(block, keys.data());
+    
+    std::size_t count = block.count;
+    std::size_t pos = std::upper_bound(keys.begin(), keys.begin() + count, key) - keys.begin();
+    std::copy_backward(keys.begin() + pos, keys.begin() + count, keys.begin() + count + 1);
+    keys[pos] = key;
+    count++;
+    keyCount++;
+    
+    if (count <= BLOCK_KEYS) {
+        block = pack(keys.data(), count);
+        return;
+    }
+    
+    std::size_t half = count / 2;
+    block = pack(keys.data(), half);
+    blocks.insert(blocks.begin() + index + 1, pack(keys.data() + half, count - half));
+}
+
+template <typename T>
+bool PackedIndex<T>::remove(T key) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    if (blocks.empty() || key < blocks.front().base) {
+        return false;
+    }
+    
+    std::size_t index = findBlock(key);
+    std::array<T, 2 * BLOCK_KEYS> keys;
+    unpack(blocks[index], keys.data());
+    
+    std::size_t count = blocks[index].count;
+    auto it = std::lower_bound(keys.begin(), keys.begin() + count, key);
+    if (it == keys.begin() + count || *it != key) {
+        return false;
+    }
+    std::copy(it + 1, keys.begin() + count, it);
+    count--;
+    keyCount--;
+    
+    if (count == 0) {
+        blocks.erase(blocks.begin() + index);
+        return true;
+    }
+    
+    if (count < BLOCK_KEYS / 4 && index + 1 < blocks.size() && count + blocks[index + 1].count <= BLOCK_KEYS) {
+        unpack(blocks[index + 1], keys.data() + count);
+        count += blocks[index + 1].count;
+        blocks.erase(blocks.begin() + index + 1);
+    }
+    
+    blocks[index] = pack(keys.data(), count);
+    return true;
+}
+
+template <typename T>
+std::size_t PackedIndex<T>::size() const {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    return keyCount;
+}
+
+template <typename T>
+std::size_t PackedIndex<T>::memoryUsage() const {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    std::size_t bytes = sizeof(*this) + blocks.capacity() * sizeof(Block);
+    for (const Block& block : blocks) {
+        bytes += block.words.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+template <typename T>
+typename PackedIndex<T>::Block PackedIndex<T>::pack(const T* keys, std::size_t count) {
+    Block block;
+    block.base = keys[0];
+    block.count = static_cast<uint16_t>(count);
+    block.bits = static_cast<uint8_t>(std::bit_width(static_cast<Delta>(static_cast<Delta>(keys[count - 1]) -
+                                                                        static_cast<Delta>(keys[0]))));
+    block.words.assign((count * block.bits + 63) / 64, 0);
+    
+    for (std::size_t i = 0; i < count && block.bits > 0; ++i) {
+        uint64_t delta = static_cast<Delta>(static_cast<Delta>(keys[i]) - static_cast<Delta>(block.base));
+        std::size_t bit = i * block.bits;
+        std::size_t shift = bit % 64;
+        block.words[bit / 64] |= delta << shift;
+        if (shift + block.bits > 64) {
+            block.words[bit / 64 + 1] |= delta >> (64 - shift);
+        }
+    }
+    return block;
+}
+
+template <typename T>
+void PackedIndex<T>::unpack(const Block& block, T* out) {
+    const uint64_t* words = block.words.data();
+    const unsigned bits = block.bits;
+    const uint64_t mask = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+    const Delta base = static_cast<Delta>(block.base);
+    
+    for (std::size_t i = 0; i < block.count; ++i) {
+        std::size_t bit = i * bits;
+        std::size_t shift = bit % 64;
+        uint64_t low = words[bit / 64] >> shift;
+        uint64_t high = shift + bits > 64 ? words[bit / 64 + 1] << (64 - shift) : 0;
+        out[i] = static_cast<T>(static_cast<Delta>(base + static_cast<Delta>((low | high) & mask)));
+    }
+}
+
+template <typename T>
+typename PackedIndex<T>::Delta PackedIndex<T>::extract(const Block& block, std::size_t i) {
+    if (block.bits == 0) {
+        return 0;
+    }
+    
+    std::size_t bit = i * block.bits;
+    std::size_t shift = bit % 64;
+    uint64_t value = block.words[bit / 64] >> shift;
+    if (shift + block.bits > 64) {
+        value |= block.words[bit / 64 + 1] << (64 - shift);
+    }
+    return static_cast<Delta>(block.bits == 64 ? value : value & ((uint64_t(1) << block.bits) - 1));
+}
+
+template <typename T>
+std::size_t PackedIndex<T>::findBlock(T key) const {
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), key,
+                               [](T value, const Block& block) { return value < block.base; });
+    return it == blocks.begin() ? 0 : (it - blocks.begin()) - 1;
+}
+
+template <typename T>
+void PackedIndex<T>::append(const T* keys, std::size_t count) {
+    blocks.push_back(pack(keys, count));
+    keyCount += count;
+}
+
+template <typename T>
+CountedMultiset<T>::CountedMultiset(int degree) : tree(degree), total(0) {}
+
+template <typename T>
+void CountedMultiset<T>::insert(const T& key) {
+    tree.upsert(CountedKey<T>{key, 1}, [](CountedKey<T>& stored) { stored.count++; });
+    total.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+bool CountedMultiset<T>::remove(const T& key) {
+    bool found = tree.update_or_erase(key, [](CountedKey<T>& stored) { return --stored.count == 0; });
+    if (found) {
+        total.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return found;
+}
+
+template <typename T>
+bool CountedMultiset<T>::search(const T& key) const {
+    return tree.search(key);
+}
+
+template <typename T>
+std::size_t CountedMultiset<T>::count(const T& key) const {
+    std::optional<CountedKey<T>> stored = tree.find(key);
+    return stored ? stored->count : 0;
+}
+
+template <typename T>
+std::size_t CountedMultiset<T>::size() const {
+    return total.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+std::size_t CountedMultiset<T>::distinct() const {
+    return tree.size();
+}
+
+template <typename T>
+FrozenIndex<T>::FrozenIndex(std::vector<T> sorted) {
+    std::vector<std::size_t> source(sorted.size());
+    std::size_t next = 0;
+    placeInOrder(source, 1, next);
+    
+    layout.reserve(sorted.size());
+    for (std::size_t index : source) {
+        layout.push_back(std::move(sorted[index]));
+    }
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+bool FrozenIndex<T>::contains(const K& key) const {
+    std::size_t k = descend(key);
+    return k != 0 && key == layout[k - 1];
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+void FrozenIndex<T>::contains(const std::vector<K>& keys, std::vector<bool>& found) const {
+    found.assign(keys.size(), false);
+    std::size_t n = layout.size();
+    if (n == 0) return;
+    
+    int depth = std::bit_width(n);
+    std::array<std::size_t, BATCH> k;
+    for (std::size_t base = 0; base < keys.size(); base += BATCH) {
+        std::size_t group = std::min(BATCH, keys.size() - base);
+        k.fill(1);
+        
+        for (int level = 0; level < depth; ++level) {
+            for (std::size_t j = 0; j < group; ++j) {
+                std::size_t current = std::min(k[j], n);
+                std::size_t next = 2 * k[j] + (layout[current - 1] < keys[base + j]);
+                k[j] = k[j] <= n ? next : k[j];
+                __builtin_prefetch(&layout[std::min(k[j], n) - 1]);
+            }
+        }
+        
+        for (std::size_t j = 0; j < group; ++j) {
+            std::size_t pos = k[j] >> (std::countr_one(k[j]) + 1);
+            found[base + j] = pos != 0 && keys[base + j] == layout[pos - 1];
+        }
+    }
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+const T* FrozenIndex<T>::lowerBound(const K& key) const {
+    std::size_t k = descend(key);
+    return k != 0 ? &layout[k - 1] : nullptr;
+}
+
+template <typename T>
+std::size_t FrozenIndex<T>::size() const {
+    return layout.size();
+}
+
+template <typename T>
+std::size_t FrozenIndex<T>::memoryUsage() const {
+    return sizeof(*this) + layout.capacity() * sizeof(T);
+}
+
+template <typename T>
+template <typename K>
+std::size_t FrozenIndex<T>::descend(const K& key) const {
+    std::size_t n = layout.size();
+    std::size_t k = 1;
+    while (k <= n) {
+        if (k * PREFETCH_STRIDE <= n) {
+            __builtin_prefetch(&layout[k * PREFETCH_STRIDE - 1]);
+        }
+        k = 2 * k + (layout[k - 1] < key);
+    }
+    return k >> (std::countr_one(k) + 1);
+}
+
+template <typename T>
+void FrozenIndex<T>::placeInOrder(std::vector<std::size_t>& source, std::size_t node, std::size_t& next) {
+    if (node > source.size()) return;
+    
+    placeInOrder(source, 2 * node, next);
+    source[node - 1] = next++;
+    placeInOrder(source, 2 * node + 1, next);
+}
+
+MappedPool::PinScope::PinScope(const MappedPool& pool, bool writable)
+    : pool_(pool), writable_(writable), mark_(pinned_frames().size()) {}
+
+MappedPool::PinScope::~PinScope() {
+    auto& pinned = pinned_frames();
+    if (pinned.size() == mark_) return;
+
+    std::lock_guard<std::mutex> lock(pool_.buffer_mutex_);
+    std::size_t kept = mark_;
+    for (std::size_t i = mark_; i < pinned.size(); ++i) {
+        if (pinned[i].first != &pool_) {
+            pinned[kept++] = pinned[i];
+            continue;
+        }
+        Frame& frame = pool_.frames_[pinned[i].second];
+        frame.dirty = frame.dirty || writable_;
+        frame.pins--;
+    }
+    pinned.resize(kept);
+}
+
+MappedPool::MappedPool(const std::string& path, uint32_t keySize, std::size_t cachePages)
+    : fd_(-1), base_(nullptr), created_(false), header_{}, clock_hand_(0), misses_(0), stopping_(false) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "MappedPool: cannot open " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        int error = errno;
+        ::close(fd_);
+        throw std::system_error(error, std::generic_category(), "MappedPool: cannot stat " + path);
+    }
+
+    created_ = st.st_size == 0;
+    if (created_ && ftruncate(fd_, PAGE_SIZE) != 0) {
+        int error = errno;
+        ::close(fd_);
+        throw std::system_error(error, std::generic_category(), "MappedPool: cannot resize " + path);
+    }
+
+    if (cachePages == 0) {
+        void* mapping = mmap(nullptr, MAX_MAPPING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd_, 0);
+        if (mapping == MAP_FAILED) {
+            int error = errno;
+            ::close(fd_);
+            throw std::system_error(error, std::generic_category(), "MappedPool: cannot map " + path);
+        }
+        base_ = static_cast<uint8_t*>(mapping);
+    } else if (!created_ && pread(fd_, &header_, sizeof(Header), 0) != static_cast<ssize_t>(sizeof(Header))) {
+        int error = errno;
+        ::close(fd_);
+        throw std::system_error(error, std::generic_category(), "MappedPool: cannot read header of " + path);
+    }
+
+    Header& head = header();
+    if (created_) {
+        head.magic = MAGIC;
+        head.version = VERSION;
+        head.pageSize = PAGE_SIZE;
+        head.keySize = keySize;
+        head.degree = 0;
+        head.root = 0;
+        head.freeHead = 0;
+        head.pageCount = 1;
+        head.keyCount = 0;
+    } else if (head.magic != MAGIC || head.version != VERSION || head.pageSize != PAGE_SIZE ||
+               head.keySize != keySize || static_cast<uint64_t>(st.st_size) < head.pageCount * PAGE_SIZE) {
+        if (base_) {
+            munmap(base_, MAX_MAPPING_SIZE);
+        }
+        ::close(fd_);
+        throw std::runtime_error("MappedPool: " + path + " is not a compatible index file");
+    }
+
+    if (cachePages != 0) {
+        frames_.resize(std::max(cachePages, MIN_CACHE_PAGES));
+        frame_data_.resize(frames_.size() * PAGE_SIZE / sizeof(uint64_t));
+        prefetcher_ = std::thread(&MappedPool::run_prefetcher, this);
+    }
+}
+
+MappedPool::~MappedPool() {
+    if (buffered()) {
+        {
+            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            stopping_ = true;
+        }
+        prefetch_wake_.notify_all();
+        prefetcher_.join();
+    }
+
+    sync();
+    if (base_) {
+        munmap(base_, MAX_MAPPING_SIZE);
+    }
+    ::close(fd_);
+}
+
+bool MappedPool::created() const {
+    return created_;
+}
+
+MappedPool::Header& MappedPool::header() const {
+    return base_ ? *reinterpret_cast<Header*>(base_) : header_;
+}
+
+void* MappedPool::at(uint64_t offset) const {
+    return base_ ? base_ + offset : pin(offset, true);
+}
+
+void MappedPool::prefetch(uint64_t offset) const {
+    if (base_) {
+        madvise(base_ + offset, PAGE_SIZE, MADV_WILLNEED);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        if (frame_of_.count(offset) != 0 || prefetch_queue_.size() >= PREFETCH_QUEUE_LIMIT) {
+            return;
+        }
+        prefetch_queue_.push_back(offset);
+    }
+    prefetch_wake_.notify_one();
+}
+
+uint64_t MappedPool::allocate() {
+    Header& head = header();
+    if (head.freeHead == 0) {
+        expand_pool();
+    }
+
+    uint64_t offset = head.freeHead;
+    head.freeHead = *static_cast<uint64_t*>(at(offset));
+    return offset;
+}
+
+void MappedPool::deallocate(uint64_t offset) {
+    if (offset == 0) return;
+
+    Header& head = header();
+    *static_cast<uint64_t*>(at(offset)) = head.freeHead;
+    head.freeHead = offset;
+}
+
+void MappedPool::sync() {
+    if (base_) {
+        msync(base_, header().pageCount * PAGE_SIZE, MS_SYNC);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    for (std::size_t i = 0; i < frames_.size(); ++i) {
+        if (frames_[i].dirty) {
+            write_frame(i);
+        }
+    }
+    if (pwrite(fd_, &header_, sizeof(Header), 0) != static_cast<ssize_t>(sizeof(Header)) || fdatasync(fd_) != 0) {
+        throw std::system_error(errno, std::generic_category(), "MappedPool: cannot write index file");
+    }
+}
+
+std::size_t MappedPool::cacheMisses() const {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    return misses_;
+}
+
+std::vector<std::pair<const MappedPool*, std::size_t>>& MappedPool::pinned_frames() {
+    thread_local std::vector<std::pair<const MappedPool*, std::size_t>> pinned;
+    return pinned;
+}
+
+bool MappedPool::buffered() const {
+    return !frames_.empty();
+}
+
+uint8_t* MappedPool::frame_bytes(std::size_t frame) const {
+    return reinterpret_cast<uint8_t*>(frame_data_.data()) + frame * PAGE_SIZE;
+}
+
+void* MappedPool::pin(uint64_t offset, bool record) const {
+    std::unique_lock<std::mutex> lock(buffer_mutex_);
+    while (true) {
+        auto it = frame_of_.find(offset);
+        if (it != frame_of_.end()) {
+            Frame& frame = frames_[it->second];
+            if (frame.loading) {
+                loaded_.wait(lock);
+                continue;
+            }
+            frame.referenced = true;
+            if (record) {
+                frame.pins++;
+                pinned_frames().emplace_back(this, it->second);
+            }
+            return frame_bytes(it->second);
+        }
+
+        std::size_t victim = evict();
+        Frame& frame = frames_[victim];
+        frame = Frame{offset, record ? 1 : 0, true, false, true};
+        frame_of_[offset] = victim;
+        misses_++;
+
+        lock.unlock();
+        ssize_t got = pread(fd_, frame_bytes(victim), PAGE_SIZE, offset);
+        lock.lock();
+        frame.loading = false;
+        loaded_.notify_all();
+
+        if (got != static_cast<ssize_t>(PAGE_SIZE)) {
+            frame_of_.erase(offset);
+            frame = Frame{};
+            throw std::system_error(errno, std::generic_category(), "MappedPool: cannot read page");
+        }
+        if (record) {
+            pinned_frames().emplace_back(this, victim);
+        }
+        return frame_bytes(victim);
+    }
+}
+
+std::size_t MappedPool::evict() const {
+    for (std::size_t step = 0; step < 2 * frames_.size(); ++step) {
+        std::size_t index = clock_hand_;
+        clock_hand_ = (clock_hand_ + 1) % frames_.size();
+
+        Frame& frame = frames_[index];
+        if (frame.pins > 0 || frame.loading) {
+            continue;
+        }
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+        if (frame.page != 0) {
+            if (frame.dirty) {
+                write_frame(index);
+            }
+            frame_of_.erase(frame.page);
+            frame.page = 0;
+        }
+        return index;
+    }
+    throw std::runtime_error("MappedPool: all buffer frames are pinned");
+}
+
+void MappedPool::write_frame(std::size_t frame) const {
+    if (pwrite(fd_, frame_bytes(frame), PAGE_SIZE, frames_[frame].page) != static_cast<ssize_t>(PAGE_SIZE)) {
+        throw std::system_error(errno, std::generic_category(), "MappedPool: cannot write page");
+    }
+    frames_[frame].dirty = false;
+}
+
+void MappedPool::run_prefetcher() {
+    std::unique_lock<std::mutex> lock(buffer_mutex_);
+    while (true) {
+        prefetch_wake_.wait(lock, [this] { return stopping_ || !prefetch_queue_.empty(); });
+        if (stopping_) {
+            return;
+        }
+
+        uint64_t offset = prefetch_queue_.front();
+        prefetch_queue_.pop_front();
+        lock.unlock();
+        try {
+            pin(offset, false);
+        } catch (const std::exception&) {
+        }
+        lock.lock();
+    }
+}
+
+void MappedPool::expand_pool() {
+    Header& head = header();
+    uint64_t newPageCount = head.pageCount + EXPANSION_PAGE_COUNT;
+    if (newPageCount * PAGE_SIZE > MAX_MAPPING_SIZE) {
+        throw std::bad_alloc();
+    }
+
+    if (buffered()) {
+        std::vector<uint64_t> region(EXPANSION_PAGE_COUNT * PAGE_SIZE / sizeof(uint64_t));
+        uint64_t next = head.freeHead;
+        for (uint64_t i = newPageCount; i-- > head.pageCount;) {
+            region[(i - head.pageCount) * PAGE_SIZE / sizeof(uint64_t)] = next;
+            next = i * PAGE_SIZE;
+        }
+        std::size_t bytes = region.size() * sizeof(uint64_t);
+        if (pwrite(fd_, region.data(), bytes, head.pageCount * PAGE_SIZE) != static_cast<ssize_t>(bytes)) {
+            throw std::system_error(errno, std::generic_category(), "MappedPool: cannot grow index file");
+        }
+        head.freeHead = next;
+        head.pageCount = newPageCount;
+        return;
+    }
+
+    if (ftruncate(fd_, newPageCount * PAGE_SIZE) != 0) {
+        throw std::system_error(errno, std::generic_category(), "MappedPool: cannot grow index file");
+    }
+
+    uint64_t next = head.freeHead;
+    for (uint64_t i = newPageCount; i-- > head.pageCount;) {
+        uint64_t offset = i * PAGE_SIZE;
+        *static_cast<uint64_t*>(at(offset)) = next;
+        next = offset;
+    }
+    head.freeHead = next;
+    head.pageCount = newPageCount;
+}
+
+template <typename T>
+void MappedBTree<T>::Path::push(uint64_t node, int index) {
+    if (depth >= MAX_HEIGHT) {
+        throw std::length_error("MappedBTree: path stack overflow");
+    }
+    entries[depth++] = PathEntry{node, index};
+}
+
+template <typename T>
+typename MappedBTree<T>::PathEntry MappedBTree<T>::Path::pop() {
+    return entries[--depth];
+}
+
+template <typename T>
+bool MappedBTree<T>::Path::empty() const {
+    return depth == 0;
+}
+
+template <typename T>
+MappedBTree<T>::MappedBTree(const std::string& path, int degree, std::size_t cachePages)
+    : pool(path, sizeof(T), cachePages) {
+    MappedPool::PinScope pins(pool, true);
+    MappedPool::Header& header = pool.header();
+    if (header.root == 0) {
+        t = degree > 0 ? std::clamp(degree, 2, MAX_KEYS / 2) : MAX_KEYS / 2;
+        header.degree = t;
+        header.keyCount = 0;
+        header.root = newPage(true);
+    } else {
+        t = header.degree;
+        if (t < 2 || 2 * t > MAX_KEYS) {
+            throw std::runtime_error("MappedBTree: " + path + " has an invalid degree");
+        }
+    }
+}
+
+template <typename T>
+MappedBTree<T>::~MappedBTree() {}
+
+template <typename T>
+typename MappedBTree<T>::Page* MappedBTree<T>::page(uint64_t offset) const {
+    return static_cast<Page*>(pool.at(offset));
+}
+
+template <typename T>
+uint64_t MappedBTree<T>::newPage(bool leaf) {
+    uint64_t offset = pool.allocate();
+    Page* node = page(offset);
+    node->count = 0;
+    node->isLeaf = leaf;
+    return offset;
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+bool MappedBTree<T>::search(const K& key) const {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex);
+    MappedPool::PinScope pins(pool, false);
+    std::size_t pos;
+    const Page* rootPage = page(pool.header().root);
+    return BTreeAlgorithms<MappedBTree>::find(*this, rootPage, key, pos) != nullptr;
+}
+
+template <typename T>
+void MappedBTree<T>::insert(const T& key) {
+    std::unique_lock<std::shared_mutex> lock(tree_mutex);
+    MappedPool::PinScope pins(pool, true);
+    Path path;
+    uint64_t offset = pool.header().root;
+    Page* node = page(offset);
+
+    while (!node->isLeaf) {
+        std::size_t i = findInsertPos(node, key);
+        path.push(offset, i);
+        offset = node->children[i];
+        node = page(offset);
+    }
+
+    insertAt(node, findInsertPos(node, key), key, 0);
+    pool.header().keyCount++;
+    splitUpward(path, offset);
+}
+
+template <typename T>
+template <typename K> requires KeyComparableWith<K, T>
+void MappedBTree<T>::remove(const K& key) {
+    std::unique_lock<std::shared_mutex> lock(tree_mutex);
+    MappedPool::PinScope pins(pool, true);
+    MappedPool::Header& header = pool.header();
+    Path path;
+    uint64_t offset = header.root;
+    Page* node = page(offset);
+    std::size_t index = 0;
+
+    while (true) {
+        index = findKey(node, key);
+        if (index < node->count && key == node->keys[index]) {
+            break;
+        }
+        if (node->isLeaf) {
+            return;
+        }
+        path.push(offset, index);
+        offset = node->children[index];
+        node = page(offset);
+    }
+
+    if (node->isLeaf) {
+        eraseAt(node, index, -1);
+    } else {
+        path.push(offset, index);
+        uint64_t leafOffset = node->children[index];
+        Page* leaf = page(leafOffset);
+        while (!leaf->isLeaf) {
+            path.push(leafOffset, leaf->count);
+            leafOffset = leaf->children[leaf->count];
+            leaf = page(leafOffset);
+        }
+
+        node->keys[index] = leaf->keys[leaf->count - 1];
+        leaf->count--;
+        offset = leafOffset;
+    }
+
+    header.keyCount--;
+    rebalanceUpward(path, offset);
+
+    Page* rootPage = page(header.root);
+    if (rootPage->count == 0 && !rootPage->isLeaf) {
+        uint64_t oldRoot = header.root;
+        header.root = rootPage->children[0];
+        pool.deallocate(oldRoot);
+    }
+}
+
+template <typename T>
+template <typename F>
+void MappedBTree<T>::forEach(F&& fn) const {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex);
+    Path path;
+    path.push(pool.header().root, 0);
+    while (!path.empty()) {
+        MappedPool::PinScope pins(pool, false);
+        PathEntry& top = path.entries[path.depth - 1];
+        const Page* node = page(top.node);
+
+        if (node->isLeaf) {
+            for (uint32_t i = 0; i < node->count; ++i) {
+                fn(node->keys[i]);
+            }
+            path.pop();
+            continue;
+        }
+
+        if (top.index > static_cast<int>(node->count)) {
+            path.pop();
+            continue;
+        }
+
+        int i = top.index++;
+        if (i > 0) {
+            fn(node->keys[i - 1]);
+        }
+        int last = std::min(i + SCAN_PREFETCH, static_cast<int>(node->count));
+        for (int ahead = i == 0 ? 1 : last; ahead <= last; ++ahead) {
+            pool.prefetch(node->children[ahead]);
+        }
+        path.push(node->children[i], 0);
+    }
+}
+
+template <typename T>
+std::size_t MappedBTree<T>::size() const {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex);
+    return pool.header().keyCount;
+}
+
+template <typename T>
+std::size_t MappedBTree<T>::cacheMisses() const {
+    return pool.cacheMisses();
+}
+
+template <typename T>
+void MappedBTree<T>::sync() {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex);
+    pool.sync();
+}
+
+template <typename T>
+std::size_t MappedBTree<T>::keyCount(uint64_t node) const {
+    return page(node)->count;
+}
+
+template <typename T>
+std::size_t MappedBTree<T>::keyCount(const Page* node) const {
+    return node->count;
+}
+
+template <typename T>
+const T& MappedBTree<T>::keyAt(const Page* node, std::size_t index) const {
+    return node->keys[index];
+}
+
+template <typename T>
+uint64_t MappedBTree<T>::childAt(uint64_t node, std::size_t index) const {
+    return page(node)->children[index];
+}
+
+template <typename T>
+const typename MappedBTree<T>::Page* MappedBTree<T>::childAt(const Page* node, std::size_t index) const {
+    return page(node->children[index]);
+}
+
+template <typename T>
+bool MappedBTree<T>::isLeaf(const Page* node) const {
+    return node->isLeaf;
+}
+
+template <typename T>
+std::size_t MappedBTree<T>::maxKeys() const {
+    return 2 * t - 1;
+}
+
+template <typename T>
+std::size_t MappedBTree<T>::minKeys() const {
+    return t - 1;
+}
+
+template <typename T>
+uint64_t MappedBTree<T>::growRoot(uint64_t node) {
+    uint64_t newRoot = newPage(false);
+    page(newRoot)->children[0] = node;
+    splitChild(newRoot, 0);
+    return newRoot;
+}
+
+template <typename T>
+bool MappedBTree<T>::absorbOverflow(uint64_t parent, int index) {
+    splitChild(parent, index);
+    return false;
+}
+
+template <typename T>
+template <typename K>
+std::size_t MappedBTree<T>::findKey(const Page* node, const K& key) const {
+    return BTreeAlgorithms<MappedBTree>::findKey(*this, node, key);
+}
+
+template <typename T>
+template <typename K>
+std::size_t MappedBTree<T>::findInsertPos(const Page* node, const K& key) const {
+    return BTreeAlgorithms<MappedBTree>::findInsertPos(*this, node, key);
+}
+
+template <typename T>
+void MappedBTree<T>::insertAt(Page* node, int index, const T& key, uint64_t rightChild) {
+    std::copy_backward(node->keys + index, node->keys + node->count, node->keys + node->count + 1);
+    node->keys[index] = key;
+    if (!node->isLeaf) {
+        std::copy_backward(node->children + index + 1, node->children + node->count + 1,
+                           node->children + node->count + 2);
+        node->children[index + 1] = rightChild;
+    }
+    node->count++;
+}
+
+template <typename T>
+void MappedBTree<T>::eraseAt(Page* node, int index, int childIndex) {
+    std::copy(node->keys + index + 1, node->keys + node->count, node->keys + index);
+    if (!node->isLeaf && childIndex >= 0) {
+        std::copy(node->children + childIndex + 1, node->children + node->count + 1, node->children + childIndex);
+    }
+    node->count--;
+}
+
+template <typename T>
+void MappedBTree<T>::splitChild(uint64_t parent, int index) {
+    Page* p = page(parent);
+    Page* y = page(p->children[index]);
+    uint64_t zOffset = newPage(y->isLeaf);
+    Page* z = page(zOffset);
+
+    z->count = y->count - t;
+    std::copy(y->keys + t, y->keys + y->count, z->keys);
+    if (!y->isLeaf) {
+        std::copy(y->children + t, y->children + y->count + 1, z->children);
+    }
+    y->count = t - 1;
+
+    insertAt(p, index, y->keys[t - 1], zOffset);
+}
+
+template <typename T>
+void MappedBTree<T>::splitUpward(Path& path, uint64_t node) {
+    BTreeAlgorithms<MappedBTree>::splitUpward(*this, path, node, pool.header().root);
+}
+
+template <typename T>
+void MappedBTree<T>::mergeNodes(uint64_t parent, int index) {
+    Page* p = page(parent);
+    Page* child = page(p->children[index]);
+    uint64_t siblingOffset = p->children[index + 1];
+    Page* sibling = page(siblingOffset);
+
+    child->keys[child->count] = p->keys[index];
+    std::copy(sibling->keys, sibling->keys + sibling->count, child->keys + child->count + 1);
+    if (!child->isLeaf) {
+        std::copy(sibling->children, sibling->children + sibling->count + 1, child->children + child->count + 1);
+    }
+    child->count += sibling->count + 1;
+
+    eraseAt(p, index, index + 1);
+    pool.deallocate(siblingOffset);
+}
+
+template <typename T>
+void MappedBTree<T>::borrowFromPrev(uint64_t parent, int index) {
+    Page* p = page(parent);
+    Page* child = page(p->children[index]);
+    Page* sibling = page(p->children[index - 1]);
+
+    std::copy_backward(child->keys, child->keys + child->count, child->keys + child->count + 1);
+    child->keys[0] = p->keys[index - 1];
+    if (!child->isLeaf) {
+        std::copy_backward(child->children, child->children + child->count + 1, child->children + child->count + 2);
+        child->children[0] = sibling->children[sibling->count];
+    }
+    child->count++;
+
+    p->keys[index - 1] = sibling->keys[sibling->count - 1];
+    sibling->count--;
+}
+
+template <typename T>
+void MappedBTree<T>::borrowFromNext(uint64_t parent, int index) {
+    Page* p = page(parent);
+    Page* child = page(p->children[index]);
+    Page* sibling = page(p->children[index + 1]);
+
+    child->keys[child->count] = p->keys[index];
+    if (!child->isLeaf) {
+        child->children[child->count + 1] = sibling->children[0];
+    }
+    child->count++;
+
+    p->keys[index] = sibling->keys[0];
+    eraseAt(sibling, 0, 0);
+}
+
+template <typename T>
+void MappedBTree<T>::fill(uint64_t parent, int index) {
+    BTreeAlgorithms<MappedBTree>::fill(*this, parent, index);
+}
+
+template <typename T>
+void MappedBTree<T>::rebalanceUpward(Path& path, uint64_t node) {
+    BTreeAlgorithms<MappedBTree>::rebalanceUpward(*this, path, node);
+}
+
+void printFrameTop() {
+    int termWidth = getTerminalWidth();
+    std::cout << CYAN << std::string(termWidth, '=') << RESET << std::endl;
+}
+
+void printFrameBottom() {
+    int termWidth = getTerminalWidth();
+    std::cout << CYAN << std::string(termWidth, '=') << RESET << std::endl;
+}
+
+void showProgressBar(int percent, bool isRunningAllTests) {
+    int termWidth = getTerminalWidth();
+    int width = termWidth * 0.6; 
+    
+    int pos = percent * width / 100;
+    
+    std::string progressBar = BOLDWHITE "[";
+    
+    for (int i = 0; i < width; ++i) {
+        if (i < pos) progressBar += GREEN "=";
+        else if (i == pos) progressBar += YELLOW ">";
+        else progressBar += RESET " ";
+    }
+    
+    progressBar += BOLDWHITE "] " + std::to_string(percent) + "%";
+    
+    int visibleLength = width + 6; 
+    int padding = std::max(0, (termWidth - visibleLength) / 2);
+    
+    std::cout << "\r" << std::string(padding, ' ') << progressBar << RESET;
+    std::cout.flush();
+    
+    if (percent == 100 && !isRunningAllTests) {
+        std::cout << std::endl;
+    }
+}
+
+int getTerminalWidth() {
+    struct winsize w;
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+    return w.ws_col;
+}
+
+void printCentered(const std::string& text) {
+    int termWidth = getTerminalWidth();
+    std::string plainText = text;
+    
+    size_t colorPos = 0;
+    int colorLen = 0;
+    
+    while (true) {
+        colorPos = plainText.find("\033[", colorPos);
+        if (colorPos == std::string::npos) break;
+        
+        size_t endPos = plainText.find('m', colorPos);
+        if (endPos != std::string::npos) {
+            int len = endPos - colorPos + 1;
+            plainText.erase(colorPos, len);
+            colorLen += len;
+        } else {
+            break;
+        }
+    }
+    
+    int textLen = text.length() - colorLen;
+    int padding = (termWidth - textLen) / 2;
+    
+    if (padding > 0)
+        std::cout << std::string(padding, ' ');
+    
+    std::cout << text << std::endl;
+}
+
+void enableRawMode(struct termios& original) {
+    struct termios raw;
+    tcgetattr(STDIN_FILENO, &original);
+    raw = original;
+    raw.c_lflag &= ~(ICANON | ECHO); 
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+}
+
+void disableRawMode(struct termios& original) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &original);
+}
+
+void runSingleTest(void (*testFunc)(), const std::string& testName) {
+    std::cout << "\033c";
+    printFrameTop();
+    printCentered(BOLDWHITE "=== Запуск теста: " + testName + " ===");
+    printFrameBottom();
+    
+    if (testName == "Финальный стресс-тест" || testName == "Финальный стресс-тест (строки)") {
+        for (float i = 0; i <= 100.0; i += 0.25) {  
+            showProgressBar(i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));  
+        }
+    } else {
+        for (int i = 0; i <= 100; i += 5) {
+            showProgressBar(i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        }
+    }
+    
+    testFunc();
+    
+    printCentered(GREEN "\nТест успешно пройден!" RESET);
+}
+
+void runAllTests() {
+    std::cout << "\033c";
+    printFrameTop();
+    printCentered(BOLDWHITE "=== Запуск всех тестов ===");
+    printFrameBottom();
+    
+    std::vector<std::pair<void(*)(), std::string>> tests = {
+        {testBasicOperations, "Базовые операции"},
+        {testEdgeCases, "Крайние случаи"},
+        {testConcurrency, "Многопоточная вставка"},
+        {testRepeatedInsertionsAndDeletions, "Повторные вставки и удаления"},
+        {testLargeRangeInsertions, "Массовая вставка большого диапазона"},
+        {testTreeSizeApproximation, "Проверка размера дерева"},
+        {testAlternatingInsertRemove, "Перемешанные вставки и удаления"},
+        {testConcurrencyMixed, "Смешанная многопоточность"},
+        {testHeavyConcurrency, "Финальный стресс-тест"},
+        {testHeavyConcurrencyString, "Финальный стресс-тест (строки)"},
+        {testInlineStringKeys, "Строковые ключи фиксированной длины"},
+        {testMoveOnlyKeys, "Перемещаемые ключи без копирования"},
+        {testMappedPersistence, "Индекс в отображаемом файле"},
+        {testSnapshotSaveLoad, "Сохранение и загрузка снимка"},
+        {testWriteAheadLog, "Журнал упреждающей записи"},
+        {testIncrementalCheckpoint, "Инкрементальные контрольные точки"},
+        {testPackedIndex, "Сжатый индекс целых ключей"},
+        {testConditionalOperations, "Условные операции за один спуск"},
+        {testCountedMultiset, "Мультимножество со счётчиками"},
+        {testKeyFilter, "Фильтр Блума перед деревом"},
+        {testLookupCache, "Кэш горячих ключей"},
+        {testLazyDelete, "Ленивое удаление с уплотнением"},
+        {testRangeRemoval, "Удаление диапазона"},
+        {testSplitJoin, "Разделение и слияние деревьев"},
+        {testReadScaling, "Масштабирование чтения"},
+        {testFrozenIndex, "Замороженный индекс"},
+        {testRedistribution, "Перераспределение перед расщеплением"},
+        {testAppendInserts, "Быстрая вставка в конец"},
+        {testPriorityQueue, "Очередь с приоритетом"},
+        {testBufferPool, "Индекс больше памяти"},
+        {testParallelTraversal, "Параллельный обход"},
+        {testMultiSearch, "Пакетный поиск"}
+    };
+    
+    for (size_t i = 0; i < tests.size(); ++i) {
+        printCentered(BOLDWHITE "\nЗапуск теста " + std::to_string(i + 1) + "/" + 
+                     std::to_string(tests.size()) + ": " + tests[i].second);
+        
+        if (i == 8 || i == 9) {  
+            for (float i = 0; i <= 100.0; i += 0.25) { 
+                showProgressBar(i);
+                std::this_thread::sleep_for(std::chrono::milliseconds(30)); 
+            }
+        } else {
+            for (int j = 0; j <= 100; j += 4) {
+                showProgressBar(j, true);
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+        }
+        
+        tests[i].first();
+        
+        int overallProgress = (i + 1) * 100 / tests.size();
+        printCentered(GREEN "✓ Тест пройден!" RESET);
+        printCentered(BOLDCYAN "Общий прогресс: " + std::to_string(overallProgress) + "%" RESET);
+    }
+    
+    std::cout << std::endl;
+    printFrameTop();
+    printCentered(GREEN "\nВсе тесты успешно пройдены!" RESET);
+    printFrameBottom();
+}
+
+void showMenu() {
+    std::cout << "\033c";
+    printFrameTop();
+    printCentered(BOLDWHITE "=== Меню тестов B-дерева ===");
+    printFrameBottom();
+
+    printCentered(GREEN "1. Базовые операции" RESET " — Вставка, поиск, удаление.");
+    printCentered(GREEN "2. Крайние случаи" RESET " — Пустое дерево, большие вставки.");
+    printCentered(GREEN "3. Многопоточная вставка" RESET " — Несколько потоков.");
+    printCentered(GREEN "4. Повторные вставки и удаления" RESET " — Двойные операции.");
+    printCentered(GREEN "5. Массовая вставка большого диапазона" RESET " — Много больших чисел.");
+    printCentered(GREEN "6. Проверка размера дерева" RESET " — Проверка после вставки/удаления.");
+    printCentered(GREEN "7. Перемешанные вставки и удаления" RESET " — Чередование операций.");
+    printCentered(GREEN "8. Смешанная многопоточность" RESET " — Вставка и удаление вместе.");
+    printCentered(GREEN "9. Финальный стресс-тест" RESET " — Серьезная нагрузка.");
+    printCentered(GREEN "s. Финальный стресс-тест (строки)" RESET " — Серьезная нагрузка со строками.");
+    printCentered(GREEN "a. Строковые ключи фиксированной длины" RESET " — InlineString вместо std::string.");
+    printCentered(GREEN "b. Перемещаемые ключи без копирования" RESET " — insert(T&&), emplace, ключи без конструктора по умолчанию.");
+    printCentered(GREEN "c. Индекс в отображаемом файле" RESET " — mmap, переоткрытие без перестроения.");
+    printCentered(GREEN "d. Сохранение и загрузка снимка" RESET " — Бинарный формат с контрольными суммами.");
+    printCentered(GREEN "e. Журнал упреждающей записи" RESET " — Групповая фиксация и восстановление.");
+    printCentered(GREEN "f. Инкрементальные контрольные точки" RESET " — Фоновая запись изменённых узлов.");
+    printCentered(GREEN "g. Сжатый индекс целых ключей" RESET " — Блоки с опорным значением и упаковкой битов.");
+    printCentered(GREEN "h. Условные операции за один спуск" RESET " — insert_if_absent, erase и upsert.");
+    printCentered(GREEN "i. Мультимножество со счётчиками" RESET " — Повторы ключа хранятся одним слотом.");
+    printCentered(GREEN "j. Фильтр Блума перед деревом" RESET " — Быстрые промахи без обхода дерева.");
+    printCentered(GREEN "k. Кэш горячих ключей" RESET " — Потоковый кэш с инвалидацией по версии.");
+    printCentered(GREEN "l. Ленивое удаление с уплотнением" RESET " — Надгробия и фоновая перебалансировка.");
+    printCentered(GREEN "m. Удаление диапазона" RESET " — Отсечение поддеревьев по граничным путям.");
+    printCentered(GREEN "n. Разделение и слияние деревьев" RESET " — split/join перевязкой узлов.");
+    printCentered(GREEN "o. Масштабирование чтения" RESET " — Блокировка со смещением в пользу читателей.");
+    printCentered(GREEN "p. Замороженный индекс" RESET " — Раскладка Эйтцингера без указателей.");
+    printCentered(GREEN "q. Перераспределение перед расщеплением" RESET " — Заполнение узлов в стиле B*-дерева.");
+    printCentered(GREEN "r. Быстрая вставка в конец" RESET " — Подсказка правого листа и асимметричное расщепление.");
+    printCentered(GREEN "t. Очередь с приоритетом" RESET " — min/max за O(1), pop_min/pop_max за один спуск.");
+    printCentered(GREEN "u. Индекс больше памяти" RESET " — страницы в файле через буферный пул с вытеснением CLOCK.");
+    printCentered(GREEN "v. Параллельный обход" RESET " — parallel_for_each/parallel_reduce по поддеревьям на пуле с перехватом задач.");
+    printCentered(GREEN "w. Пакетный поиск" RESET " — multiSearch с сортировкой ключей и общим спуском.");
+    printCentered(BOLDCYAN ": Запустить все тесты подряд" RESET);
+    printCentered(RED "0. Выход" RESET);
+
+    printFrameTop();
+    printCentered(YELLOW "Нажмите цифру (0 - 9), букву теста или : для запуска всех тестов:");
+}
+
+void testBasicOperations() {
+    std::cout << "\n=== Тест 1: Базовые операции ===" << std::endl;
+    BTree<int> tree(3);
+    
+    for (int i : {10, 20, 5, 15, 25, 30, 1, 2}) {
+        tree.insert(i);
+    }
+    
+    for (int i : {10, 20, 5, 15, 25, 30, 1, 2}) {
+        assert(tree.search(i) && "Элемент не найден после вставки");
+    }
+    
+    tree.remove(10);
+    tree.remove(5);
+    tree.remove(30);
+    
+    assert(!tree.search(10) && "Удаленный элемент найден");
+    assert(!tree.search(5) && "Удаленный элемент найден");
+    assert(!tree.search(30) && "Удаленный элемент найден");
+    
+    for (int i : {20, 15, 25, 1, 2}) {
+        assert(tree.search(i) && "Оставшийся элемент не найден");
+    }
+    
+    std::cout << "Тест 1 пройден успешно!\n";
+}
+
+void testEdgeCases() {
+    std::cout << "\n=== Тест 2: Крайние случаи ===" << std::endl;
+    BTree<int> tree(2);
+    
+    tree.insert(100);
+    assert(tree.search(100) && "Единственный элемент не найден");
+    
+    tree.remove(100);
+    assert(!tree.search(100) && "Удаленный элемент найден");
+    
+    tree.remove(42); 
+    
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        assert(tree.search(i) && "Элемент не найден после массовой вставки");
+    }
+    for (int i = 0; i < 1000; ++i) {
+        tree.remove(i);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        assert(!tree.search(i) && "Элемент найден после массового удаления");
+    }
+    
+    std::cout << "Тест 2 пройден успешно!\n";
+}
+
+void testConcurrency() {
+    std::cout << "\n=== Тест 3: Многопоточные операции ===" << std::endl;
+    for (LockMode mode : {LockMode::Shared, LockMode::ReaderBiased}) {
+        BTree<int> tree(3, mode);
+        const int numThreads = 4;
+        const int numElements = 1000;
+    
+        auto insertFunc = [&tree](int start) {
+            for (int i = start; i < start + numElements; ++i) {
+                tree.insert(i);
+            }
+        };
+    
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back(insertFunc, i * numElements);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    
+        for (int i = 0; i < numThreads * numElements; ++i) {
+            assert(tree.search(i) && "Элемент не найден после многопоточной вставки");
+        }
+    
+        threads.clear();
+        auto removeFunc = [&tree](int start) {
+            for (int i = start; i < start + numElements; ++i) {
+                tree.remove(i);
+            }
+        };
+    
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back(removeFunc, i * numElements);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    
+        for (int i = 0; i < numThreads * numElements; ++i) {
+            assert(!tree.search(i) && "Элемент найден после многопоточного удаления");
+        }
+    }
+    
+    std::cout << "Тест 3 пройден успешно!\n";
+}
+
+void testRepeatedInsertionsAndDeletions() {
+    std::cout << "\n=== Тест 4: Повторные вставки и удаления ===" << std::endl;
+    BTree<int> tree(3);
+
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(i);
+        tree.insert(i); 
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        assert(tree.search(i) && "Элемент не найден после повторной вставки");
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        tree.remove(i);
+        tree.remove(i);
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        assert(!tree.search(i) && "Элемент найден после двойного удаления");
+    }
+
+    std::cout << "Тест 4 пройден успешно!\n";
+}
+
+void testLargeRangeInsertions() {
+    std::cout << "\n=== Тест 5: Массовая вставка большого диапазона значений ===" << std::endl;
+    BTree<int> tree(5);
+
+    for (int i = 1000000; i < 1001000; ++i) {
+        tree.insert(i);
+    }
+
+    for (int i = 1000000; i < 1001000; ++i) {
+        assert(tree.search(i) && "Элемент не найден после вставки большого диапазона");
+    }
+
+    std::cout << "Тест 5 пройден успешно!\n";
+}
+
+void testTreeSizeApproximation() {
+    std::cout << "\n=== Тест 6: Приближенная проверка размера дерева ===" << std::endl;
+    BTree<int> tree(3);
+
+    for (int i = 0; i < 500; ++i) {
+        tree.insert(i);
+    }
+
+    for (int i = 250; i < 500; ++i) {
+        tree.remove(i);
+    }
+
+    for (int i = 0; i < 250; ++i) {
+        assert(tree.search(i) && "Элемент должен быть в дереве");
+    }
+
+    for (int i = 250; i < 500; ++i) {
+        assert(!tree.search(i) && "Элемент не должен быть в дереве");
+    }
+
+    assert(tree.size() == 250 && "Размер дерева не совпадает с числом ключей");
+    assert(tree.rank(100) == 100 && "Неверный ранг ключа");
+    assert(tree.rank(1000) == 250 && "Неверный ранг ключа за пределами дерева");
+    assert(tree.select(42) == 42 && "Неверный k-й элемент");
+    assert(tree.select(249) == 249 && "Неверный последний элемент");
+    assert(tree.countRange(10, 19) == 10 && "Неверное число ключей в диапазоне");
+    assert(tree.countRange(240, 300) == 10 && "Неверное число ключей в диапазоне на границе");
+    assert(tree.countRange(19, 10) == 0 && "Пустой диапазон должен давать ноль");
+
+    bool thrown = false;
+    try {
+        tree.select(250);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown && "select за пределами размера должен бросать исключение");
+
+    tree.insert(5);
+    assert(tree.size() == 251 && "Размер не учитывает дубликат");
+    assert(tree.countRange(5, 5) == 2 && "Дубликаты не учтены в диапазоне");
+    assert(tree.rank(6) == 7 && "Ранг не учитывает дубликат");
+
+    std::cout << "Размер дерева: " << tree.size() << std::endl;
+    std::cout << "Тест 6 пройден успешно!\n";
+}
+
+void testAlternatingInsertRemove() {
+    std::cout << "\n=== Тест 7: Перемешанные вставки и удаления ===" << std::endl;
+    BTree<int> tree(4);
+
+    for (int i = 0; i < 10000; i += 2) {
+        tree.insert(i);
+    }
+
+    for (int i = 0; i < 10000; ++i) {
+        if (i % 4 == 0) {
+            tree.remove(i);
+        } else if (i % 2 == 0) {
+            assert(tree.search(i) && "Элемент должен быть найден после вставки");
+        }
+    }
+
+    for (int i = 0; i < 10000; ++i) {
+        if (i % 4 == 0) {
+            assert(!tree.search(i) && "Элемент не должен быть найден после удаления");
+        }
+    }
+
+    std::cout << "Тест 7 пройден успешно!\n";
+}
+
+void testConcurrencyMixed() {
+    std::cout << "\n=== Тест 8: Смешанная многопоточность (вставка и удаление одновременно) ===" << std::endl;
+
+    for (LockMode mode : {LockMode::Shared, LockMode::ReaderBiased}) {
+        BTree<int> tree(3, mode);
+        const int numThreads = 4;
+        const int numElements = 1000;
+
+        auto insertFunc = [&tree](int start) {
+            for (int i = start; i < start + numElements; ++i) {
+                tree.insert(i);
+            }
+        };
+
+        auto removeFunc = [&tree](int start) {
+            for (int i = start; i < start + numElements; ++i) {
+                tree.remove(i);
+            }
+        };
+
+        std::vector<std::thread> threads;
+
+        for (int i = 0; i < numThreads; ++i) {
+            if (i % 2 == 0) {
+                threads.emplace_back(insertFunc, i * numElements);
+            } else {
+                threads.emplace_back(removeFunc, (i - 1) * numElements); 
+            }
+        }
+
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        int insertedElements = (numThreads / 2) * numElements;
+        int foundElements = 0;
+        for (int i = 0; i < insertedElements * 2; ++i) {
+            bool found = tree.search(i);
+            if (found) {
+                foundElements++;
+                if (i % 2 == 1) {
+                    assert(found && "Элемент должен быть найден после вставки нечетного потоком");
+                }
+            } else {
+                if (i % 2 == 0 && i < insertedElements) {
+                    assert(!found && "Элемент не должен быть найден после удаления четного потоком");
+                }
+            }
+        }
+    
+        std::cout << "Найдено элементов: " << foundElements << std::endl;
+    }
+    std::cout << "Тест 8 пройден успешно!\n";
+}
+
+void testHeavyConcurrency() {
+    std::cout << "\n=== Тест 9: Финальный стресс-тест ===" << std::endl;
+    BTree<int> tree(4);
+    const int numThreads = 16;
+    const int operationsPerThread = 50000;
+    const int keyRange = 100000;
+
+    std::atomic<bool> running{true};
+    std::atomic<int> insertCount{0};
+    std::atomic<int> removeCount{0};
+
+    std::vector<std::thread> threads;
+    std::atomic<int>* keyCounters = new std::atomic<int>[keyRange + 1]();
+
+    auto worker = [&](int id) {
+        std::mt19937 rng(std::random_device{}() + id);
+        std::uniform_int_distribution<int> opDist(0, 1);
+        std::uniform_int_distribution<int> keyDist(0, keyRange);
+    
+        for (int i = 0; i < operationsPerThread; ++i) {
+            int op = opDist(rng);
+            int key = keyDist(rng);
+    
+            if (op == 0) {
+                tree.insert(key);
+                keyCounters[key].fetch_add(1, std::memory_order_relaxed);
+                insertCount.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                int expected = keyCounters[key].load(std::memory_order_relaxed);
+                if (expected > 0) {
+                    bool success = false;
+                    while (expected > 0 && !success) {
+                        success = keyCounters[key].compare_exchange_weak(
+                            expected, expected - 1,
+                            std::memory_order_release,
+                            std::memory_order_relaxed);
+                        if (success) {
+                            tree.remove(key);
+                            removeCount.fetch_add(1, std::memory_order_relaxed);
+                        } else {
+                            expected = keyCounters[key].load(std::memory_order_relaxed);
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back(worker, i);
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::cout << "Все потоки завершены. Проверка целостности дерева..." << std::endl;
+    std::cout << "Вставлено ключей: " << insertCount.load() << std::endl;
+    std::cout << "Удалено ключей: " << removeCount.load() << std::endl;
+
+    std::unordered_set<int> finalExpectedKeys;
+    std::size_t expectedSize = 0;
+    for (int key = 0; key <= keyRange; ++key) {
+        int count = keyCounters[key].load(std::memory_order_relaxed);
+        if (count > 0) {
+            finalExpectedKeys.insert(key);
+            expectedSize += count;
+        }
+    }
+
+    std::cout << "Размер дерева: " << tree.size() << " (ожидалось " << expectedSize << ")" << std::endl;
+    assert(tree.size() == expectedSize && "Размер дерева не совпадает со счетчиками ключей!");
+
+    int foundCount = 0;
+    int discrepancies = 0;
+    std::vector<int> missingKeys;
+    std::vector<int> extraKeys;
+
+    std::vector<int> probes(keyRange + 1);
+    std::iota(probes.begin(), probes.end(), 0);
+    std::vector<bool> present;
+    tree.multiSearch(probes, present);
+
+    for (int key = 0; key <= keyRange; ++key) {
+        bool expected = finalExpectedKeys.count(key) > 0;
+        bool actual = present[key];
+
+        if (expected != actual) {
+            if (discrepancies < 10) {
+                std::cerr << "Mismatch for key " << key << ": Expected="
+                          << expected << ", Actual=" << actual 
+                          << ", Counter=" << keyCounters[key].load() << std::endl;
+                if (expected && !actual) missingKeys.push_back(key);
+                if (!expected && actual) extraKeys.push_back(key);
+            }
+            discrepancies++;
+        }
+
+        if (actual) {
+            foundCount++;
+        }
+    }
+
+    if (discrepancies > 0) {
+        std::cerr << "ОШИБКА: Обнаружено " << discrepancies << " несоответствий!" << std::endl;
+        if (!missingKeys.empty()) {
+            std::cerr << "Примеры отсутствующих ключей: ";
+            for (size_t i = 0; i < std::min(missingKeys.size(), (size_t)5); ++i) {
+                std::cerr << missingKeys[i] << " ";
+            }
+            std::cerr << std::endl;
+        }
+        if (!extraKeys.empty()) {
+            std::cerr << "Примеры лишних ключей: ";
+            for (size_t i = 0; i < std::min(extraKeys.size(), (size_t)5); ++i) {
+                std::cerr << extraKeys[i] << " ";
+            }
+            std::cerr << std::endl;
+        }
+        assert(discrepancies == 0 && "Несоответствие наличия ключа после стресс-теста!");
+    } else {
+        std::cout << "Проверка целостности дерева прошла успешно: несоответствий не обнаружено!" << std::endl;
+        std::cout << "Финальный стресс-тест успешно пройден!" << std::endl;
+    }
+    std::cout << "Найдено элементов в дереве: " << foundCount << "\n";
+
+    delete[] keyCounters;
+}
+
+void testHeavyConcurrencyString() {
+    std::cout << "\n=== Тест 10: Финальный стресс-тест(строки) ===" << std::endl;
+    BTree<std::string> tree(4);
+    const int numThreads = 16;
+    const int operationsPerThread = 50000;
+    const int keyRange = 100000;
+
+    std::atomic<bool> running{true};
+    std::atomic<int> insertCount{0};
+    std::atomic<int> removeCount{0};
+
+    std::vector<std::thread> threads;
+    std::atomic<int>* keyCounters = new std::atomic<int>[keyRange + 1]();
+
+    auto worker = [&](int id) {
+        std::mt19937 rng(std::random_device{}() + id);
+        std::uniform_int_distribution<int> opDist(0, 1);
+        std::uniform_int_distribution<int> keyDist(0, keyRange);
+    
+        for (int i = 0; i < operationsPerThread; ++i) {
+            int op = opDist(rng);
+            std::string key = "key_" + std::to_string(keyDist(rng));
+            int keyIndex = std::stoi(key.substr(4));
+    
+            if (op == 0) {
+                tree.insert(key);
+                keyCounters[keyIndex].fetch_add(1, std::memory_order_relaxed);
+                insertCount.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                int expected = keyCounters[keyIndex].load(std::memory_order_relaxed);
+                if (expected > 0) {
+                    bool success = false;
+                    while (expected > 0 && !success) {
+                        success = keyCounters[keyIndex].compare_exchange_weak(
+                            expected, expected - 1,
+                            std::memory_order_release,
+                            std::memory_order_relaxed);
+                        if (success) {
+                            tree.remove(key);
+                            removeCount.fetch_add(1, std::memory_order_relaxed);
+                        } else {
+                            expected = keyCounters[keyIndex].load(std::memory_order_relaxed);
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back(worker, i);
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::cout << "Все потоки завершены. Проверка целостности дерева..." << std::endl;
+    std::cout << "Вставлено ключей: " << insertCount.load() << std::endl;
+    std::cout << "Удалено ключей: " << removeCount.load() << std::endl;
+
+    std::unordered_set<int> finalExpectedKeys;
+    std::size_t expectedSize = 0;
+    for (int key = 0; key <= keyRange; ++key) {
+        int count = keyCounters[key].load(std::memory_order_relaxed);
+        if (count > 0) {
+            finalExpectedKeys.insert(key);
+            expectedSize += count;
+        }
+    }
+
+    std::cout << "Размер дерева: " << tree.size() << " (ожидалось " << expectedSize << ")" << std::endl;
+    assert(tree.size() == expectedSize && "Размер дерева не совпадает со счетчиками ключей!");
+
+    int foundCount = 0;
+    int discrepancies = 0;
+    std::vector<std::string> missingKeys;
+    std::vector<std::string> extraKeys;
+
+    char keyBuffer[32] = "key_";
+    for (int key = 0; key <= keyRange; ++key) {
+        char* keyEnd = std::to_chars(keyBuffer + 4, keyBuffer + sizeof(keyBuffer), key).ptr;
+        std::string_view keyStr(keyBuffer, keyEnd - keyBuffer);
+        bool expected = finalExpectedKeys.count(key) > 0;
+        bool actual = tree.search(keyStr);
+
+        if (expected != actual) {
+            if (discrepancies < 10) {
+                std::cerr << "Mismatch for key " << keyStr << ": Expected="
+                          << expected << ", Actual=" << actual 
+                          << ", Counter=" << keyCounters[key].load() << std::endl;
+                if (expected && !actual) missingKeys.emplace_back(keyStr);
+                if (!expected && actual) extraKeys.emplace_back(keyStr);
+            }
+            discrepancies++;
+        }
+
+        if (actual) {
+            foundCount++;
+        }
+    }
+
+    if (discrepancies > 0) {
+        std::cerr << "ОШИБКА: Обнаружено " << discrepancies << " несоответствий!" << std::endl;
+        if (!missingKeys.empty()) {
+            std::cerr << "Примеры отсутствующих ключей: ";
+            for (size_t i = 0; i < std::min(missingKeys.size(), (size_t)5); ++i) {
+                std::cerr << missingKeys[i] << " ";
+            }
+            std::cerr << std::endl;
+        }
+        if (!extraKeys.empty()) {
+            std::cerr << "Примеры лишних ключей: ";
+            for (size_t i = 0; i < std::min(extraKeys.size(), (size_t)5); ++i) {
+                std::cerr << extraKeys[i] << " ";
+            }
+            std::cerr << std::endl;
+        }
+        assert(discrepancies == 0 && "Несоответствие наличия ключа после стресс-теста!");
+    } else {
+        std::cout << "Проверка целостности дерева прошла успешно: несоответствий не обнаружено!" << std::endl;
+        std::cout << "Финальный стресс-тест успешно пройден!" << std::endl;
+    }
+    std::cout << "Найдено элементов в дереве: " << foundCount << "\n";
+
+    delete[] keyCounters;
+}
+
+void testInlineStringKeys() {
+    std::cout << "\n=== Тест 11: Строковые ключи фиксированной длины ===" << std::endl;
+    using Key = InlineString<15>;
+    static_assert(sizeof(Key) == 16, "InlineString<15> должен занимать 16 байт");
+
+    BTree<Key> tree(4);
+    const int numKeys = 20000;
+
+    for (int i = 0; i < numKeys; ++i) {
+        tree.insert(Key("key_" + std::to_string(i)));
+    }
+
+    for (int i = 0; i < numKeys; ++i) {
+        assert(tree.search(Key("key_" + std::to_string(i))) && "Ключ не найден после вставки");
+    }
+
+    for (int i = 0; i < numKeys; i += 2) {
+        tree.remove(Key("key_" + std::to_string(i)));
+    }
+
+    for (int i = 0; i < numKeys; ++i) {
+        bool expected = i % 2 == 1;
+        assert(tree.search(Key("key_" + std::to_string(i))) == expected && "Неверный результат поиска после удаления");
+    }
+
+    std::vector<std::string> words = {"", "a", "ab", "abc", "abd", "b", "key_1", "key_10", "key_9"};
+    for (size_t i = 0; i < words.size(); ++i) {
+        for (size_t j = 0; j < words.size(); ++j) {
+            assert(((Key(words[i]) < Key(words[j])) == (words[i] < words[j])) && "Порядок InlineString расходится с std::string");
+            assert(((Key(words[i]) == Key(words[j])) == (words[i] == words[j])) && "Равенство InlineString расходится с std::string");
+        }
+    }
+
+    for (int i = 1; i < numKeys; i += 2) {
+        std::string probe = "key_" + std::to_string(i);
+        assert(tree.search(std::string_view(probe)) && "Ключ не найден по string_view");
+    }
+    assert(!tree.search("key_0") && "Удаленный ключ найден по строковому литералу");
+
+    tree.remove(std::string_view("key_1"));
+    assert(!tree.search(Key("key_1")) && "Ключ не удален по string_view");
+
+    BTree<std::string> stringTree(3);
+    for (const std::string& word : words) {
+        stringTree.insert(word);
+    }
+    for (const std::string& word : words) {
+        assert(stringTree.search(std::string_view(word)) && "Строка не найдена по string_view");
+    }
+    assert(!stringTree.search("missing") && "Отсутствующая строка найдена");
+    stringTree.remove(std::string_view("abc"));
+    assert(!stringTree.search("abc") && "Строка не удалена по string_view");
+
+    bool thrown = false;
+    try {
+        Key tooLong("this_key_is_way_too_long");
+    } catch (const std::length_error&) {
+        thrown = true;
+    }
+    assert(thrown && "Слишком длинный ключ должен отклоняться");
+
+    std::cout << "Размер ключа: " << sizeof(Key) << " байт против " << sizeof(std::string) << " байт у std::string" << std::endl;
+    std::cout << "Тест 11 пройден успешно!\n";
+}
+
+struct MoveOnlyKey {
+    std::unique_ptr<int> value;
+
+    explicit MoveOnlyKey(int v) : value(std::make_unique<int>(v)) {}
+    MoveOnlyKey(MoveOnlyKey&&) = default;
+    MoveOnlyKey& operator=(MoveOnlyKey&&) = default;
+
+    bool operator==(const MoveOnlyKey& other) const { return *value == *other.value; }
+    std::strong_ordering operator<=>(const MoveOnlyKey& other) const { return *value <=> *other.value; }
+    bool operator==(int other) const { return *value == other; }
+    std::strong_ordering operator<=>(int other) const { return *value <=> other; }
+};
+
+void testMoveOnlyKeys() {
+    std::cout << "\n=== Тест 12: Перемещаемые ключи без копирования ===" << std::endl;
+    BTree<MoveOnlyKey> tree(3);
+    const int numKeys = 5000;
+
+    for (int i = 0; i < numKeys; ++i) {
+        if (i % 2 == 0) {
+            tree.emplace(i);
+        } else {
+            tree.insert(MoveOnlyKey(i));
+        }
+    }
+
+    for (int i = 0; i < numKeys; ++i) {
+        assert(tree.search(i) && "Ключ не найден после emplace/insert(T&&)");
+    }
+
+    for (int i = 0; i < numKeys; i += 3) {
+        tree.remove(i);
+    }
+
+    for (int i = 0; i < numKeys; ++i) {
+        assert(tree.search(i) == (i % 3 != 0) && "Неверный результат поиска после удаления");
+    }
+
+    assert(tree.size() == numKeys - (numKeys + 2) / 3 && "Неверный размер дерева с перемещаемыми ключами");
+
+    BTree<std::string> stringTree(2);
+    std::string longKey(64, 'x');
+    for (int i = 0; i < 1000; ++i) {
+        std::string key = longKey + std::to_string(i);
+        stringTree.insert(std::move(key));
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        stringTree.remove(longKey + std::to_string(i));
+    }
+    for (int i = 0; i < 1000; ++i) {
+        assert(stringTree.search(longKey + std::to_string(i)) == (i % 2 == 1) && "Неверный результат поиска строки");
+    }
+
+    std::cout << "Тест 12 пройден успешно!\n";
+}
+
+void testMappedPersistence() {
+    std::cout << "\n=== Тест 13: Индекс в отображаемом файле ===" << std::endl;
+    char path[] = "/tmp/btree_mapped_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0 && "Не удалось создать временный файл");
+    close(fd);
+
+    const int numKeys = 50000;
+    {
+        MappedBTree<int> tree(path, 8);
+        for (int i = 0; i < numKeys; ++i) {
+            tree.insert((i * 7919) % numKeys);
+        }
+        for (int i = 0; i < numKeys; i += 2) {
+            tree.remove(i);
+        }
+        tree.remove(-1);
+        assert(tree.size() == numKeys / 2 && "Неверный размер индекса до закрытия");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        MappedBTree<int> tree(path);
+        auto reopened = std::chrono::steady_clock::now();
+        std::cout << "Переоткрытие индекса: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(reopened - start).count() << " мкс" << std::endl;
+
+        assert(tree.size() == numKeys / 2 && "Размер индекса не сохранился");
+        for (int i = 0; i < numKeys; ++i) {
+            assert(tree.search(i) == (i % 2 == 1) && "Ключ индекса не сохранился после переоткрытия");
+        }
+
+        for (int i = 0; i < numKeys; i += 2) {
+            tree.insert(i);
+        }
+        tree.insert(1);
+        for (int i = 1; i < numKeys; i += 2) {
+            tree.remove(i);
+        }
+        assert(tree.search(1) && "Дубликат должен остаться после одного удаления");
+        tree.remove(1);
+    }
+
+    {
+        MappedBTree<int> tree(path);
+        assert(tree.size() == numKeys / 2 && "Размер индекса не сохранился после второго открытия");
+        for (int i = 0; i < numKeys; ++i) {
+            assert(tree.search(i) == (i % 2 == 0) && "Ключ индекса не сохранился после второго открытия");
+        }
+    }
+
+    bool thrown = false;
+    try {
+        MappedBTree<long long> wrongType(path);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown && "Файл с другим типом ключа должен отклоняться");
+
+    unlink(path);
+    std::cout << "Тест 13 пройден успешно!\n";
+}
+
+void testSnapshotSaveLoad() {
+    std::cout << "\n=== Тест 14: Сохранение и загрузка снимка ===" << std::endl;
+    char path[] = "/tmp/btree_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0 && "Не удалось создать временный файл");
+
+    const int numKeys = 1000000;
+    BTree<int> tree(16);
+    std::mt19937 rng(42);
+    for (int i = 0; i < numKeys; ++i) {
+        tree.insert(static_cast<int>(rng() % (numKeys / 2)));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    tree.save(fd);
+    auto saved = std::chrono::steady_clock::now();
+
+    BTree<int> loaded(5);
+    loaded.insert(-1);
+    lseek(fd, 0, SEEK_SET);
+    loaded.load(fd);
+    auto done = std::chrono::steady_clock::now();
+
+    double megabytes = numKeys * sizeof(int) / (1024.0 * 1024.0);
+    std::cout << "Сохранение: " << megabytes / std::chrono::duration<double>(saved - start).count() << " МБ/с, "
+              << "загрузка: " << megabytes / std::chrono::duration<double>(done - saved).count() << " МБ/с" << std::endl;
+
+    assert(loaded.size() == tree.size() && "Размер не совпадает после загрузки");
+    assert(!loaded.search(-1) && "Старое содержимое должно быть заменено");
+    for (int i = 0; i < numKeys / 2; i += 97) {
+        assert(loaded.search(i) == tree.search(i) && "Наличие ключа не совпадает после загрузки");
+        assert(loaded.countRange(i, i) == tree.countRange(i, i) && "Число дубликатов не совпадает после загрузки");
+    }
+    for (std::size_t k = 0; k < tree.size(); k += 4099) {
+        assert(loaded.select(k) == tree.select(k) && "Порядок ключей не совпадает после загрузки");
+    }
+
+    for (int i = 0; i < 10000; ++i) {
+        loaded.insert(numKeys + i);
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        loaded.remove(numKeys + i);
+    }
+    assert(loaded.size() == tree.size() + 5000 && "Загруженное дерево должно оставаться изменяемым");
+
+    char byte;
+    lseek(fd, 4096, SEEK_SET);
+    assert(read(fd, &byte, 1) == 1);
+    byte ^= 0x5a;
+    lseek(fd, 4096, SEEK_SET);
+    assert(write(fd, &byte, 1) == 1);
+
+    BTree<int> corrupted(3);
+    corrupted.insert(7);
+    bool thrown = false;
+    try {
+        lseek(fd, 0, SEEK_SET);
+        corrupted.load(fd);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown && "Поврежденный снимок должен отклоняться");
+    assert(corrupted.size() == 1 && corrupted.search(7) && "Дерево не должно меняться при ошибке загрузки");
+
+    BTree<std::string> strings(4);
+    for (int i = 0; i < 20000; ++i) {
+        strings.insert("key_" + std::to_string(i * 13 % 20000));
+    }
+    lseek(fd, 0, SEEK_SET);
+    assert(ftruncate(fd, 0) == 0);
+    strings.save(fd);
+
+    BTree<std::string> loadedStrings(2);
+    lseek(fd, 0, SEEK_SET);
+    loadedStrings.load(fd);
+    assert(loadedStrings.size() == 20000 && "Размер строкового дерева не совпадает после загрузки");
+    for (int i = 0; i < 20000; ++i) {
+        assert(loadedStrings.search("key_" + std::to_string(i)) && "Строковый ключ потерян после загрузки");
+    }
+
+    close(fd);
+    unlink(path);
+    std::cout << "Тест 14 пройден успешно!\n";
+}
+
+void testWriteAheadLog() {
+    std::cout << "\n=== Тест 15: Журнал упреждающей записи ===" << std::endl;
+    char path[] = "/tmp/btree_wal_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0 && "Не удалось создать временный файл");
+    close(fd);
+    unlink(path);
+
+    const int numThreads = 8;
+    const int numElements = 500;
+    uint64_t batches = 0;
+
+    {
+        WriteAheadLog<int> log(path);
+        BTree<int> tree(3);
+        tree.attachLog(&log);
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back([&tree, i]() {
+                for (int key = i * numElements; key < (i + 1) * numElements; ++key) {
+                    tree.insert(key);
+                }
+                for (int key = i * numElements; key < (i + 1) * numElements; key += 5) {
+                    tree.remove(key);
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        tree.remove(-1);
+
+        batches = log.batchCount();
+    }
+
+    const int records = numThreads * numElements + numThreads * numElements / 5;
+    std::cout << "Записей в журнале: " << records << ", сбросов на диск: " << batches << std::endl;
+    assert(batches > 0 && batches * 2 <= static_cast<uint64_t>(records) && "Групповая фиксация должна объединять записи в пакеты");
+
+    fd = open(path, O_WRONLY | O_APPEND);
+    assert(fd >= 0);
+    const char garbage[] = "torn tail";
+    ssize_t written = write(fd, garbage, sizeof(garbage));
+    close(fd);
+    assert(written == sizeof(garbage));
+
+    {
+        WriteAheadLog<int> log(path);
+        BTree<int> tree(4);
+        std::size_t replayed = tree.recover(log);
+        assert(replayed == static_cast<std::size_t>(records) && "Восстановлено неверное число записей");
+        assert(tree.size() == static_cast<std::size_t>(numThreads * numElements * 4 / 5) && "Неверный размер после восстановления");
+        for (int key = 0; key < numThreads * numElements; ++key) {
+            assert(tree.search(key) == (key % 5 != 0) && "Неверное содержимое после восстановления");
+        }
+
+        tree.insert(-7);
+    }
+
+    char forged[sizeof(uint64_t) + 1] = {};
+    uint64_t forgedLsn = records + 100;
+    std::memcpy(forged, &forgedLsn, sizeof(forgedLsn));
+    uint64_t forgedHeader[2] = {sizeof(forged), snapshotChecksum(forged, sizeof(forged))};
+    fd = open(path, O_WRONLY | O_APPEND);
+    assert(fd >= 0);
+    ssize_t headerWritten = write(fd, forgedHeader, sizeof(forgedHeader));
+    written = write(fd, forged, sizeof(forged));
+    close(fd);
+    assert(headerWritten == sizeof(forgedHeader) && written == sizeof(forged));
+
+    {
+        WriteAheadLog<int> log(path);
+        BTree<int> tree(4);
+        std::size_t replayed = tree.recover(log);
+        assert(replayed == static_cast<std::size_t>(records) + 1 && "Запись без ключа не должна воспроизводиться");
+        assert(tree.search(-7) && "Запись после восстановления потеряна");
+    }
+
+    unlink(path);
+    std::cout << "Тест 15 пройден успешно!\n";
+}
+
+void testIncrementalCheckpoint() {
+    std::cout << "\n=== Тест 16: Инкрементальные контрольные точки ===" << std::endl;
+    char dir[] = "/tmp/btree_ckpt_XXXXXX";
+    assert(mkdtemp(dir) && "Не удалось создать временный каталог");
+    std::string checkpointPath = std::string(dir) + "/tree.ckpt";
+    std::string logPath = std::string(dir) + "/tree.wal";
+
+    const int numElements = 20000;
+    const int rounds = 40;
+    const int roundSize = 500;
+    struct stat info;
+
+    {
+        WriteAheadLog<int> log(logPath);
+        BTree<int> tree(3);
+        Checkpointer<int> checkpointer(tree, checkpointPath, &log, std::chrono::hours(1));
+
+        for (int i = 0; i < numElements; ++i) {
+            tree.insert(i);
+        }
+        std::size_t fullNodes = checkpointer.checkpoint();
+        uint64_t fullBytes = checkpointer.fileSize();
+        assert(stat(logPath.c_str(), &info) == 0 && info.st_size <= 64 && "Журнал не усечён после контрольной точки");
+
+        for (int r = 0; r < rounds; ++r) {
+            for (int i = 0; i < roundSize; ++i) {
+                tree.insert(numElements + r * roundSize + i);
+                tree.remove(r * roundSize + i);
+            }
+            checkpointer.checkpoint();
+        }
+        std::cout << "Полная точка: " << fullBytes << " байт, файл после " << rounds << " инкрементальных: "
+                  << checkpointer.fileSize() << " байт" << std::endl;
+        assert(checkpointer.fileSize() < 3 * fullBytes + Checkpointer<int>::COMPACTION_SLACK && "Файл контрольных точек не уплотняется");
+
+        for (int i = 0; i < 10; ++i) {
+            tree.insert(100000 + i * 1000);
+        }
+        std::size_t incrementalNodes = checkpointer.checkpoint();
+        std::cout << "Узлов в полной точке: " << fullNodes << ", после 10 вставок: " << incrementalNodes << std::endl;
+        assert(incrementalNodes > 0 && incrementalNodes * 20 < fullNodes && "Контрольная точка не инкрементальная");
+    }
+
+    const int numThreads = 4;
+    const int threadElements = 5000;
+
+    {
+        WriteAheadLog<int> log(logPath);
+        BTree<int> tree(3);
+        Checkpointer<int> checkpointer(tree, checkpointPath, &log, std::chrono::milliseconds(2));
+        assert(tree.size() == static_cast<std::size_t>(numElements + 10) && "Неверный размер после восстановления");
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back([&tree, i]() {
+                int base = 200000 + i * threadElements;
+                for (int key = base; key < base + threadElements; ++key) {
+                    tree.insert(key);
+                    if (key % 7 == 0) {
+                        tree.remove(key);
+                    }
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        tree.insert(-1);
+        tree.insert(-2);
+    }
+
+    {
+        WriteAheadLog<int> log(logPath);
+        BTree<int> tree(3);
+        Checkpointer<int> checkpointer(tree, checkpointPath, &log, std::chrono::hours(1));
+
+        std::size_t expected = 0;
+        for (int key = numElements; key < numElements + rounds * roundSize; ++key, ++expected) {
+            assert(tree.search(key) && "Ключ из контрольной точки потерян");
+        }
+        for (int key = 0; key < rounds * roundSize; ++key) {
+            assert(!tree.search(key) && "Удалённый ключ восстановлен");
+        }
+        for (int i = 0; i < 10; ++i, ++expected) {
+            assert(tree.search(100000 + i * 1000));
+        }
+        for (int key = 200000; key < 200000 + numThreads * threadElements; ++key) {
+            bool present = key % 7 != 0;
+            assert(tree.search(key) == present && "Неверное содержимое после восстановления");
+            expected += present;
+        }
+        assert(tree.search(-1) && tree.search(-2) && "Записи из журнала не воспроизведены");
+        expected += 2;
+        assert(tree.size() == expected && "Неверный размер после восстановления");
+    }
+
+    unlink(checkpointPath.c_str());
+    unlink(logPath.c_str());
+    rmdir(dir);
+    std::cout << "Тест 16 пройден успешно!\n";
+}
+
+void testPackedIndex() {
+    std::cout << "\n=== Тест 17: Сжатый индекс целых ключей ===" << std::endl;
+    BTree<int> tree(5);
+    const int numElements = 200000;
+    auto key = [](int i) { return 1000000 + i + (i / 1000) * 1000; };
+
+    for (int i = 0; i < numElements; ++i) {
+        tree.insert(key(i));
+    }
+    tree.insert(-5);
+    tree.insert(std::numeric_limits<int>::max());
+    tree.insert(std::numeric_limits<int>::min());
+
+    PackedIndex<int> index(tree);
+    assert(index.size() == tree.size() && "Размер сжатого индекса не совпадает с деревом");
+
+    double bytesPerKey = static_cast<double>(index.memoryUsage()) / index.size();
+    std::cout << "Байт на ключ в сжатом индексе: " << bytesPerKey << std::endl;
+    assert(bytesPerKey * 3 < sizeof(int) && "Сжатие должно уменьшать объём в несколько раз");
+
+    for (int i = 0; i < numElements; ++i) {
+        assert(index.search(key(i)) && "Ключ не найден в сжатом индексе");
+        assert(!index.search(key(i) + 1000) && "Найден отсутствующий ключ");
+    }
+    assert(index.search(-5) && index.search(std::numeric_limits<int>::max()) && index.search(std::numeric_limits<int>::min()));
+    assert(!index.search(0) && !index.search(std::numeric_limits<int>::max() - 1));
+
+    for (int i = 0; i < numElements; i += 2) {
+        assert(index.remove(key(i)) && "Ключ не удалён из сжатого индекса");
+    }
+    assert(!index.remove(key(0)));
+    for (int i = 0; i < 1000; ++i) {
+        index.insert(key(i) + 1000);
+    }
+
+    for (int i = 0; i < numElements; ++i) {
+        assert(index.search(key(i)) == (i % 2 == 1) && "Неверное содержимое после удаления");
+        assert(index.search(key(i) + 1000) == (i < 1000) && "Неверное содержимое после вставки");
+    }
+    assert(index.size() == tree.size() - numElements / 2 + 1000 && "Неверный размер после изменений");
+
+    std::cout << "Тест 17 пройден успешно!\n";
+}
+
+struct HitCounter {
+    int key;
+    int hits;
+
+    bool operator==(const HitCounter& other) const { return key == other.key; }
+    auto operator<=>(const HitCounter& other) const { return key <=> other.key; }
+    bool operator==(int other) const { return key == other; }
+    auto operator<=>(int other) const { return key <=> other; }
+};
+
+void testConditionalOperations() {
+    std::cout << "\n=== Тест 18: Условные операции за один спуск ===" << std::endl;
+    BTree<int> tree(3);
+    const int numThreads = 8;
+    const int operationsPerThread = 50000;
+    const int keyRange = 2000;
+
+    assert(tree.insert_if_absent(42) && !tree.insert_if_absent(42) && "Повторная вставка должна быть отклонена");
+    assert(tree.size() == 1);
+    assert(tree.erase(42) && !tree.erase(42) && "Повторное удаление должно вернуть false");
+    assert(tree.size() == 0);
+
+    std::vector<std::atomic<int>> present(keyRange);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&, i]() {
+            std::mt19937 rng(i);
+            std::uniform_int_distribution<int> keyDist(0, keyRange - 1);
+            for (int op = 0; op < operationsPerThread; ++op) {
+                int key = keyDist(rng);
+                if (rng() % 2 == 0) {
+                    if (tree.insert_if_absent(key)) {
+                        present[key].fetch_add(1, std::memory_order_relaxed);
+                    }
+                } else if (tree.erase(key)) {
+                    present[key].fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::size_t expectedSize = 0;
+    for (int key = 0; key < keyRange; ++key) {
+        int count = present[key].load();
+        assert((count == 0 || count == 1) && "Ключ вставлен больше одного раза");
+        assert(tree.search(key) == (count == 1) && "Результаты операций не совпадают с содержимым дерева");
+        expectedSize += count;
+    }
+    assert(tree.size() == expectedSize && "Неверный размер дерева");
+
+    BTree<HitCounter> counters(3);
+    for (int round = 0; round < 5; ++round) {
+        for (int key = 0; key < 1000; ++key) {
+            bool inserted = counters.upsert(HitCounter{key, 1}, [](HitCounter& stored) { stored.hits++; });
+            assert(inserted == (round == 0) && "upsert должен вставлять ключ только один раз");
+        }
+    }
+    assert(counters.size() == 1000);
+    for (int key = 0; key < 1000; key += 37) {
+        assert(counters.select(counters.rank(key)).hits == 5 && "upsert не обновил значение");
+    }
+
+    std::cout << "Тест 18 пройден успешно!\n";
+}
+
+void testCountedMultiset() {
+    std::cout << "\n=== Тест 19: Мультимножество со счётчиками ===" << std::endl;
+    CountedMultiset<int> multiset(3);
+
+    for (int i = 0; i < 100; ++i) {
+        for (int copy = 0; copy <= i % 5; ++copy) {
+            multiset.insert(i);
+        }
+    }
+    assert(multiset.distinct() == 100 && "Каждый ключ должен занимать один слот");
+    assert(multiset.size() == 300 && "Неверное общее число вхождений");
+    for (int i = 0; i < 100; ++i) {
+        assert(multiset.count(i) == static_cast<std::size_t>(i % 5 + 1) && "Неверный счётчик ключа");
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        assert(multiset.remove(i) && "Удаление существующего вхождения не удалось");
+    }
+    for (int i = 0; i < 100; ++i) {
+        assert(multiset.search(i) == (i % 5 != 0) && "Ключ должен исчезнуть, когда счётчик дошёл до нуля");
+    }
+    assert(!multiset.remove(0) && multiset.count(0) == 0);
+
+    CountedMultiset<int> shared(4);
+    const int numThreads = 8;
+    const int operationsPerThread = 50000;
+    const int keyRange = 64;
+    std::vector<std::atomic<int>> counters(keyRange);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&, i]() {
+            std::mt19937 rng(i);
+            for (int op = 0; op < operationsPerThread; ++op) {
+                int key = rng() % keyRange;
+                if (rng() % 3 != 0) {
+                    shared.insert(key);
+                    counters[key].fetch_add(1, std::memory_order_relaxed);
+                } else if (shared.remove(key)) {
+                    counters[key].fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::size_t expectedSize = 0;
+    for (int key = 0; key < keyRange; ++key) {
+        assert(shared.count(key) == static_cast<std::size_t>(counters[key].load()) && "Счётчик не совпадает с операциями");
+        expectedSize += counters[key].load();
+    }
+    std::cout << "Вхождений: " << shared.size() << ", различных ключей: " << shared.distinct() << std::endl;
+    assert(shared.size() == expectedSize && shared.distinct() <= static_cast<std::size_t>(keyRange));
+
+    std::cout << "Тест 19 пройден успешно!\n";
+}
+
+void testKeyFilter() {
+    std::cout << "\n=== Тест 20: Фильтр Блума перед деревом ===" << std::endl;
+    BTree<int> tree(4);
+    const int numElements = 100000;
+
+    for (int i = 0; i < numElements; ++i) {
+        tree.insert(i * 2);
+    }
+
+    auto measureMisses = [&tree]() {
+        auto start = std::chrono::high_resolution_clock::now();
+        int found = 0;
+        for (int i = 0; i < numElements; ++i) {
+            found += tree.search(i * 2 + 1);
+        }
+        assert(found == 0 && "Найден отсутствующий ключ");
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    double withoutFilter = measureMisses();
+    tree.enableFilter();
+    assert(tree.filterCapacity() >= static_cast<std::size_t>(numElements));
+    double withFilter = measureMisses();
+    std::cout << "Промахи без фильтра: " << withoutFilter << " мс, с фильтром: " << withFilter << " мс" << std::endl;
+
+    for (int i = 0; i < numElements; ++i) {
+        assert(tree.search(i * 2) && "Фильтр отверг существующий ключ");
+    }
+
+    for (int i = 0; i < numElements; i += 2) {
+        tree.remove(i * 2);
+    }
+    for (int i = 0; i < numElements; ++i) {
+        assert(tree.search(i * 2) == (i % 2 == 1) && "Неверный результат после удаления");
+    }
+
+    std::size_t capacityBefore = tree.filterCapacity();
+    for (int i = 0; i < 4 * numElements; ++i) {
+        tree.insert(1000000 + i);
+    }
+    for (int i = 0; i < 10000; ++i) {
+        tree.search(-1 - i);
+    }
+    std::cout << "Ёмкость фильтра: " << capacityBefore << " -> " << tree.filterCapacity() << std::endl;
+    assert(tree.filterCapacity() > capacityBefore && "Фильтр не перестроен после переполнения");
+
+    const int numThreads = 8;
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&tree, &failed, i]() {
+            int base = 5000000 + i * 10000;
+            for (int key = base; key < base + 10000; ++key) {
+                tree.insert(key);
+                if (!tree.search(key)) {
+                    failed = true;
+                }
+                if (key % 3 == 0) {
+                    tree.remove(key);
+                    if (tree.search(key)) {
+                        failed = true;
+                    }
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(!failed && "Фильтр дал неверный ответ при параллельной работе");
+
+    std::cout << "Тест 20 пройден успешно!\n";
+}
+
+void testLookupCache() {
+    std::cout << "\n=== Тест 21: Кэш горячих ключей ===" << std::endl;
+    BTree<int> tree(4);
+    const int numElements = 200000;
+    const int hotKeys = 64;
+    const int lookups = 2000000;
+
+    for (int i = 0; i < numElements; ++i) {
+        tree.insert(i);
+    }
+
+    auto measureHotLookups = [&tree]() {
+        auto start = std::chrono::high_resolution_clock::now();
+        int found = 0;
+        for (int i = 0; i < lookups; ++i) {
+            found += tree.search(i * 37 % hotKeys * 1000);
+        }
+        assert(found == lookups && "Горячий ключ не найден");
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    double withoutCache = measureHotLookups();
+    tree.enableLookupCache();
+    double withCache = measureHotLookups();
+    std::cout << "Поиск горячих ключей без кэша: " << withoutCache << " мс, с кэшем: " << withCache << " мс" << std::endl;
+
+    assert(tree.search(5000));
+    tree.remove(5000);
+    assert(!tree.search(5000) && "Кэш вернул устаревший результат после удаления");
+    tree.insert(5000);
+    assert(tree.search(5000) && "Кэш вернул устаревший результат после вставки");
+
+    BTree<int> other(4);
+    other.enableLookupCache();
+    assert(!other.search(5000) && "Кэш смешал результаты разных деревьев");
+
+    std::atomic<int> removedUpTo{-1};
+    std::atomic<bool> stale{false};
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&]() {
+            while (!done.load()) {
+                int removed = removedUpTo.load(std::memory_order_acquire);
+                for (int key = 0; key < hotKeys; ++key) {
+                    if (key <= removed && tree.search(key)) {
+                        stale = true;
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        });
+    }
+    for (int key = 0; key < hotKeys; ++key) {
+        tree.remove(key);
+        removedUpTo.store(key, std::memory_order_release);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    done = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    assert(!stale && "Поток увидел удалённый ключ через кэш");
+
+    tree.disableLookupCache();
+    assert(!tree.search(0) && tree.search(hotKeys));
+
+    std::cout << "Тест 21 пройден успешно!\n";
+}
+
+void testLazyDelete() {
+    std::cout << "\n=== Тест 22: Ленивое удаление с уплотнением ===" << std::endl;
+    const int numElements = 200000;
+
+    auto measureErase = [](BTree<int>& tree) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < numElements; i += 2) {
+            assert(tree.erase(i) && "Существующий ключ не удалён");
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    BTree<int> eager(3);
+    BTree<int> lazy(3);
+    for (int i = 0; i < numElements; ++i) {
+        eager.insert(i);
+        lazy.insert(i);
+    }
+    lazy.enableLazyDelete();
+
+    double eagerTime = measureErase(eager);
+    double lazyTime = measureErase(lazy);
+    std::cout << "Удаление с перебалансировкой: " << eagerTime << " мс, ленивое: " << lazyTime << " мс" << std::endl;
+
+    assert(lazy.pendingRebalances() > 0 && lazy.stats().underfull > 0 && "Ленивое удаление не должно перебалансировать узлы");
+    assert(lazy.size() == static_cast<std::size_t>(numElements / 2) && "Неверный размер после ленивого удаления");
+    for (int i = 0; i < numElements; ++i) {
+        assert(lazy.search(i) == (i % 2 == 1) && "Удалённый ключ виден при поиске");
+    }
+    assert(!lazy.erase(0) && "Повторное ленивое удаление должно вернуть false");
+    assert(lazy.rank(1001) == 500 && lazy.pendingRebalances() > 0 && "rank не должен уплотнять дерево");
+    assert(lazy.pop_min() == 1 && lazy.pop_min() == 3 && lazy.min() == 5 && lazy.pop_max() == numElements - 1);
+    lazy.insert(1);
+    lazy.insert(3);
+    lazy.insert(numElements - 1);
+
+    for (int copy = 0; copy < 3; ++copy) {
+        lazy.insert(-5);
+    }
+    assert(lazy.erase(-5) && lazy.erase(-5) && lazy.search(-5) && "Оставшийся дубликат должен быть виден");
+    assert(lazy.erase(-5) && !lazy.search(-5) && !lazy.erase(-5));
+    assert(lazy.insert_if_absent(-5) && !lazy.insert_if_absent(-5) && "Вставка после ленивого удаления не удалась");
+    assert(lazy.find(-5) && lazy.erase(-5) && !lazy.find(-5));
+    assert(lazy.compact() > 0 && lazy.pendingRebalances() == 0 && lazy.countRange(-10, -1) == 0);
+    assert(lazy.stats().underfull == 0 && lazy.size() == static_cast<std::size_t>(numElements / 2) && "Уплотнение должно восстановить заполнение узлов");
+
+    BTree<int> tree(4);
+    {
+        NodeCompactor<int> compactor(tree, std::chrono::milliseconds(2));
+        const int numThreads = 8;
+        const int threadElements = 10000;
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back([&tree, i]() {
+                int base = i * threadElements;
+                for (int key = base; key < base + threadElements; ++key) {
+                    tree.insert(key);
+                }
+                for (int key = base; key < base + threadElements; key += 3) {
+                    assert(tree.erase(key) && "Ключ не удалён при фоновом уплотнении");
+                }
+            });
         }
-    } else {
-        for (int i = 0; i <= 100; i += 5) {
-            showProgressBar(i);
-            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        for (int key = 0; key < numThreads * threadElements; ++key) {
+            assert(tree.search(key) == (key % threadElements % 3 != 0) && "Неверное содержимое при фоновом уплотнении");
         }
     }
-    
-    testFunc();
-    
-    printCentered(GREEN "\nТест успешно пройден!" RESET);
+    assert(tree.pendingRebalances() == 0 && tree.stats().underfull == 0 && "Узлы должны быть перебалансированы при остановке уплотнителя");
+
+    tree.enableLazyDelete();
+    {
+        NodeCompactor<int> compactor(tree, std::chrono::milliseconds(2));
+    }
+    assert(tree.lazyDeleteEnabled() && "Уплотнитель не должен отключать ленивый режим, включённый до него");
+    tree.disableLazyDelete();
+    assert(tree.size() == static_cast<std::size_t>(8 * (10000 - 3334)) && "Неверный размер после уплотнения");
+
+    std::cout << "Тест 22 пройден успешно!\n";
 }
 
-void runAllTests() {
-    std::cout << "\033c";
-    printFrameTop();
-    printCentered(BOLDWHITE "=== Запуск всех тестов ===");
-    printFrameBottom();
-    
-    std::vector<std::pair<void(*)(), std::string>> tests = {
-        {testBasicOperations, "Базовые операции"},
-        {testEdgeCases, "Крайние случаи"},
-        {testConcurrency, "Многопоточная вставка"},
-        {testRepeatedInsertionsAndDeletions, "Повторные вставки и удаления"},
-        {testLargeRangeInsertions, "Массовая вставка большого диапазона"},
-        {testTreeSizeApproximation, "Проверка размера дерева"},
-        {testAlternatingInsertRemove, "Перемешанные вставки и удаления"},
-        {testConcurrencyMixed, "Смешанная многопоточность"},
-        {testHeavyConcurrency, "Финальный стресс-тест"},
-        {testHeavyConcurrencyString, "Финальный стресс-тест (строки)"}
-    };
-    
-    for (size_t i = 0; i < tests.size(); ++i) {
-        printCentered(BOLDWHITE "\nЗапуск теста " + std::to_string(i + 1) + "/" + 
-                     std::to_string(tests.size()) + ": " + tests[i].second);
-        
-        if (i == 8 || i == 9) {  
-            for (float i = 0; i <= 100.0; i += 0.25) { 
-                showProgressBar(i);
-                std::this_thread::sleep_for(std::chrono::milliseconds(30)); 
+void testRangeRemoval() {
+    std::cout << "\n=== Тест 23: Удаление диапазона ===" << std::endl;
+    const int numElements = 500000;
+
+    BTree<int> perKey(4);
+    BTree<int> ranged(4);
+    for (int i = 0; i < numElements; ++i) {
+        perKey.insert(i);
+        ranged.insert(i);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = numElements / 4; i < numElements / 4 * 3; ++i) {
+        perKey.remove(i);
+    }
+    double perKeyTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    std::size_t removed = ranged.removeRange(numElements / 4, numElements / 4 * 3 - 1);
+    double rangeTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Поштучное удаление: " << perKeyTime << " мс, removeRange: " << rangeTime << " мс" << std::endl;
+
+    assert(removed == static_cast<std::size_t>(numElements / 2) && "Неверное число удалённых ключей");
+    assert(ranged.size() == perKey.size() && "Размеры деревьев не совпадают");
+    for (int i = 0; i < numElements; i += 97) {
+        assert(ranged.search(i) == perKey.search(i) && "Содержимое деревьев расходится");
+    }
+    assert(ranged.select(numElements / 4) == numElements / 4 * 3 && "Порядковая статистика после удаления неверна");
+    assert(ranged.removeRange(10, 5) == 0 && ranged.removeRange(numElements, numElements * 2) == 0);
+
+    std::mt19937 rng(41);
+    for (int degree = 2; degree <= 5; ++degree) {
+        BTree<int> tree(degree);
+        std::vector<int> reference;
+        for (int round = 0; round < 50; ++round) {
+            for (int i = 0; i < 200; ++i) {
+                int key = rng() % 5000;
+                tree.insert(key);
+                reference.insert(std::upper_bound(reference.begin(), reference.end(), key), key);
             }
-        } else {
-            for (int j = 0; j <= 100; j += 4) {
-                showProgressBar(j, true);
-                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+            int lo = static_cast<int>(rng() % 5200) - 100;
+            int hi = lo + static_cast<int>(rng() % 800);
+            auto first = std::lower_bound(reference.begin(), reference.end(), lo);
+            auto last = std::upper_bound(reference.begin(), reference.end(), hi);
+            std::size_t expected = last - first;
+            reference.erase(first, last);
+
+            assert(tree.removeRange(lo, hi) == expected && "Неверное число удалённых ключей");
+            assert(tree.size() == reference.size() && tree.countRange(lo, hi) == 0);
+            for (std::size_t i = 0; i < reference.size(); i += 7) {
+                assert(tree.select(i) == reference[i] && "Порядок ключей нарушен после удаления диапазона");
             }
         }
-        
-        tests[i].first();
-        
-        int overallProgress = (i + 1) * 100 / tests.size();
-        printCentered(GREEN "✓ Тест пройден!" RESET);
-        printCentered(BOLDCYAN "Общий прогресс: " + std::to_string(overallProgress) + "%" RESET);
-    }
-    
-    std::cout << std::endl;
-    printFrameTop();
-    printCentered(GREEN "\nВсе тесты успешно пройдены!" RESET);
-    printFrameBottom();
-}
-
-void showMenu() {
-    std::cout << "\033c";
-    printFrameTop();
-    printCentered(BOLDWHITE "=== Меню тестов B-дерева ===");
-    printFrameBottom();
 
-    printCentered(GREEN "1. Базовые операции" RESET " — Вставка, поиск, удаление.");
-    printCentered(GREEN "2. Крайние случаи" RESET " — Пустое дерево, большие вставки.");
-    printCentered(GREEN "3. Многопоточная вставка" RESET " — Несколько потоков.");
-    printCentered(GREEN "4. Повторные вставки и удаления" RESET " — Двойные операции.");
-    printCentered(GREEN "5. Массовая вставка большого диапазона" RESET " — Много больших чисел.");
-    printCentered(GREEN "6. Проверка размера дерева" RESET " — Проверка после вставки/удаления.");
-    printCentered(GREEN "7. Перемешанные вставки и удаления" RESET " — Чередование операций.");
-    printCentered(GREEN "8. Смешанная многопоточность" RESET " — Вставка и удаление вместе.");
-    printCentered(GREEN "9. Финальный стресс-тест" RESET " — Серьезная нагрузка.");
-    printCentered(GREEN "s. Финальный стресс-тест (строки)" RESET " — Серьезная нагрузка со строками.");
-    printCentered(BOLDCYAN ": Запустить все тесты подряд" RESET);
-    printCentered(RED "0. Выход" RESET);
+        assert(tree.removeRange(std::numeric_limits<int>::min(), std::numeric_limits<int>::max()) == reference.size());
+        assert(tree.size() == 0 && !tree.search(reference.empty() ? 0 : reference.front()));
+        tree.insert(1);
+        assert(tree.search(1) && tree.size() == 1 && "Дерево не работает после полной очистки");
+    }
 
-    printFrameTop();
-    printCentered(YELLOW "Нажмите цифру (0 - 9), s или : для запуска всех тестов:");
+    std::cout << "Тест 23 пройден успешно!\n";
 }
 
-void testBasicOperations() {
-    std::cout << "\n=== Тест 1: Базовые операции ===" << std::endl;
-    BTree<int> tree(3);
-    
-    for (int i : {10, 20, 5, 15, 25, 30, 1, 2}) {
+void testSplitJoin() {
+    std::cout << "\n=== Тест 24: Разделение и слияние деревьев ===" << std::endl;
+    const int numElements = 500000;
+
+    BTree<int> tree(4);
+    BTree<int> shard(4);
+    BTree<int> copied(4);
+    for (int i = 0; i < numElements; ++i) {
         tree.insert(i);
     }
-    
-    for (int i : {10, 20, 5, 15, 25, 30, 1, 2}) {
-        assert(tree.search(i) && "Элемент не найден после вставки");
-    }
-    
-    tree.remove(10);
-    tree.remove(5);
-    tree.remove(30);
-    
-    assert(!tree.search(10) && "Удаленный элемент найден");
-    assert(!tree.search(5) && "Удаленный элемент найден");
-    assert(!tree.search(30) && "Удаленный элемент найден");
-    
-    for (int i : {20, 15, 25, 1, 2}) {
-        assert(tree.search(i) && "Оставшийся элемент не найден");
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = numElements / 2; i < numElements; ++i) {
+        copied.insert(i);
     }
-    
-    std::cout << "Тест 1 пройден успешно!\n";
-}
+    double copyTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-void testEdgeCases() {
-    std::cout << "\n=== Тест 2: Крайние случаи ===" << std::endl;
-    BTree<int> tree(2);
-    
-    tree.insert(100);
-    assert(tree.search(100) && "Единственный элемент не найден");
-    
-    tree.remove(100);
-    assert(!tree.search(100) && "Удаленный элемент найден");
-    
-    tree.remove(42); 
-    
-    for (int i = 0; i < 1000; ++i) {
-        tree.insert(i);
+    start = std::chrono::high_resolution_clock::now();
+    tree.split(numElements / 2, shard);
+    double splitTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Перевставка половины ключей: " << copyTime << " мс, split: " << splitTime << " мс" << std::endl;
+
+    assert(tree.size() == static_cast<std::size_t>(numElements / 2) && shard.size() == copied.size());
+    assert(!tree.search(numElements / 2) && shard.search(numElements / 2) && tree.search(numElements / 2 - 1));
+    assert(shard.select(0) == numElements / 2 && shard.rank(numElements - 1) == copied.size() - 1);
+
+    bool rejected = false;
+    try {
+        tree.split(0, copied);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
     }
-    for (int i = 0; i < 1000; ++i) {
-        assert(tree.search(i) && "Элемент не найден после массовой вставки");
+    assert(rejected && "split в непустое дерево должен завершаться ошибкой");
+
+    shard.join(tree);
+    assert(tree.size() == 0 && shard.size() == static_cast<std::size_t>(numElements));
+    for (int i = 0; i < numElements; i += 101) {
+        assert(shard.select(i) == i && "Порядок ключей нарушен после join");
     }
-    for (int i = 0; i < 1000; ++i) {
-        tree.remove(i);
+
+    BTree<int> overlapping(4);
+    overlapping.insert(numElements / 3);
+    rejected = false;
+    try {
+        shard.join(overlapping);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
     }
-    for (int i = 0; i < 1000; ++i) {
-        assert(!tree.search(i) && "Элемент найден после массового удаления");
+    assert(rejected && overlapping.size() == 1 && "join пересекающихся диапазонов должен завершаться ошибкой");
+
+    std::mt19937 rng(42);
+    for (int degree = 2; degree <= 5; ++degree) {
+        BTree<int> left(degree);
+        BTree<int> right(degree);
+        std::vector<int> reference;
+        for (int i = 0; i < 4000; ++i) {
+            int key = rng() % 1500;
+            left.insert(key);
+            reference.push_back(key);
+        }
+        std::sort(reference.begin(), reference.end());
+
+        for (int round = 0; round < 40; ++round) {
+            int key = static_cast<int>(rng() % 1600) - 50;
+            left.split(key, right);
+            std::size_t boundary = std::lower_bound(reference.begin(), reference.end(), key) - reference.begin();
+            assert(left.size() == boundary && right.size() == reference.size() - boundary);
+            assert(left.countRange(key, 2000) == 0 && right.countRange(-100, key - 1) == 0);
+
+            if (round % 2 == 0) {
+                left.join(right);
+            } else {
+                right.join(left);
+                right.split(std::numeric_limits<int>::min(), left);
+            }
+            assert(left.size() == reference.size() && right.size() == 0);
+            for (std::size_t i = 0; i < reference.size(); i += 13) {
+                assert(left.select(i) == reference[i] && "Порядок ключей нарушен после split/join");
+            }
+        }
     }
-    
-    std::cout << "Тест 2 пройден успешно!\n";
+
+    std::cout << "Тест 24 пройден успешно!\n";
 }
 
-void testConcurrency() {
-    std::cout << "\n=== Тест 3: Многопоточные операции ===" << std::endl;
-    BTree<int> tree(3);
-    const int numThreads = 4;
-    const int numElements = 1000;
-    
-    auto insertFunc = [&tree](int start) {
-        for (int i = start; i < start + numElements; ++i) {
+void testReadScaling() {
+    std::cout << "\n=== Тест 25: Масштабирование чтения ===" << std::endl;
+    const int numElements = 100000;
+    const int lookupsPerThread = 200000;
+
+    auto measure = [&](LockMode mode, int numThreads, bool withWriter) {
+        BTree<int> tree(8, mode);
+        for (int i = 0; i < numElements; i += 2) {
             tree.insert(i);
         }
-    };
-    
-    std::vector<std::thread> threads;
-    for (int i = 0; i < numThreads; ++i) {
-        threads.emplace_back(insertFunc, i * numElements);
-    }
-    for (auto& t : threads) {
-        t.join();
-    }
-    
-    for (int i = 0; i < numThreads * numElements; ++i) {
-        assert(tree.search(i) && "Элемент не найден после многопоточной вставки");
-    }
-    
-    threads.clear();
-    auto removeFunc = [&tree](int start) {
-        for (int i = start; i < start + numElements; ++i) {
-            tree.remove(i);
+
+        std::atomic<bool> stop(false);
+        std::thread writer;
+        if (withWriter) {
+            writer = std::thread([&tree, &stop, numElements]() {
+                for (int i = 1; !stop.load(); i = (i + 2) % numElements) {
+                    tree.insert(i);
+                    tree.remove(i);
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            });
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back([&tree, i, numElements, lookupsPerThread]() {
+                for (int j = 0; j < lookupsPerThread; ++j) {
+                    int key = (j * 37 + i * 1009) % numElements & ~1;
+                    assert(tree.search(key) && "Существующий ключ не найден");
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        stop = true;
+        if (writer.joinable()) {
+            writer.join();
         }
+        assert(tree.size() == static_cast<std::size_t>(numElements / 2) && "Писатель нарушил содержимое дерева");
+        return numThreads * lookupsPerThread / elapsed / 1e6;
     };
-    
-    for (int i = 0; i < numThreads; ++i) {
-        threads.emplace_back(removeFunc, i * numElements);
-    }
-    for (auto& t : threads) {
-        t.join();
+
+    const unsigned hardwareThreads = std::thread::hardware_concurrency();
+    std::cout << "Аппаратных потоков: " << hardwareThreads << std::endl;
+    for (bool withWriter : {false, true}) {
+        std::cout << (withWriter ? "С фоновым писателем:" : "Только чтение:") << std::endl;
+        for (int numThreads : {1, 2, 4, 8}) {
+            double shared = measure(LockMode::Shared, numThreads, withWriter);
+            double biased = measure(LockMode::ReaderBiased, numThreads, withWriter);
+            std::cout << "  потоков: " << numThreads << ", shared_mutex: " << shared
+                      << " млн/с, со смещением: " << biased << " млн/с" << std::endl;
+            if (!withWriter && numThreads >= 4 && static_cast<unsigned>(numThreads) <= hardwareThreads) {
+                assert(biased >= 1.5 * shared && "Смещённая блокировка не ускорила параллельное чтение");
+            }
+        }
     }
-    
-    for (int i = 0; i < numThreads * numElements; ++i) {
-        assert(!tree.search(i) && "Элемент найден после многопоточного удаления");
+    if (hardwareThreads < 4) {
+        std::cout << "Проверка ускорения пропущена: меньше 4 аппаратных потоков" << std::endl;
     }
-    
-    std::cout << "Тест 3 пройден успешно!\n";
+
+    std::cout << "Тест 25 пройден успешно!\n";
 }
 
-void testRepeatedInsertionsAndDeletions() {
-    std::cout << "\n=== Тест 4: Повторные вставки и удаления ===" << std::endl;
-    BTree<int> tree(3);
+void testFrozenIndex() {
+    std::cout << "\n=== Тест 26: Замороженный индекс ===" << std::endl;
+    const int numElements = 1000000;
+    const int numLookups = 2000000;
 
-    for (int i = 0; i < 100; ++i) {
-        tree.insert(i);
-        tree.insert(i); 
+    BTree<int> tree(8);
+    std::mt19937 rng(44);
+    for (int i = 0; i < numElements; ++i) {
+        tree.insert(static_cast<int>(rng() % (numElements * 4)) & ~1);
     }
+    tree.insert(7);
+    tree.insert(7);
 
-    for (int i = 0; i < 100; ++i) {
-        assert(tree.search(i) && "Элемент не найден после повторной вставки");
+    FrozenIndex<int> frozen = tree.freeze();
+    assert(frozen.size() == tree.size() && "Размер замороженного индекса не совпадает с деревом");
+
+    std::vector<int> probes(numLookups);
+    for (int& probe : probes) {
+        probe = static_cast<int>(rng() % (numElements * 4));
     }
 
-    for (int i = 0; i < 100; ++i) {
-        tree.remove(i);
-        tree.remove(i);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::size_t treeHits = 0;
+    for (int probe : probes) {
+        treeHits += tree.search(probe);
     }
+    double treeTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-    for (int i = 0; i < 100; ++i) {
-        assert(!tree.search(i) && "Элемент найден после двойного удаления");
+    start = std::chrono::high_resolution_clock::now();
+    std::size_t frozenHits = 0;
+    for (int probe : probes) {
+        frozenHits += frozen.contains(probe);
     }
+    double frozenTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-    std::cout << "Тест 4 пройден успешно!\n";
-}
+    start = std::chrono::high_resolution_clock::now();
+    std::vector<bool> found;
+    frozen.contains(probes, found);
+    double batchTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-void testLargeRangeInsertions() {
-    std::cout << "\n=== Тест 5: Массовая вставка большого диапазона значений ===" << std::endl;
-    BTree<int> tree(5);
+    std::cout << "Поиск в дереве: " << treeTime << " мс, в замороженном индексе: " << frozenTime
+              << " мс, пакетный поиск: " << batchTime << " мс" << std::endl;
+    std::cout << "Память дерева: " << tree.memoryUsage() / 1024 << " КБ, замороженного индекса: "
+              << frozen.memoryUsage() / 1024 << " КБ" << std::endl;
 
-    for (int i = 1000000; i < 1001000; ++i) {
-        tree.insert(i);
+    assert(treeHits == frozenHits && "Результаты поиска расходятся");
+    assert(static_cast<std::size_t>(std::count(found.begin(), found.end(), true)) == treeHits);
+    for (int i = 0; i < numLookups; i += 17) {
+        assert(found[i] == tree.search(probes[i]) && "Пакетный поиск расходится с деревом");
     }
+    assert(frozen.memoryUsage() < tree.memoryUsage() && "Замороженный индекс должен занимать меньше памяти");
 
-    for (int i = 1000000; i < 1001000; ++i) {
-        assert(tree.search(i) && "Элемент не найден после вставки большого диапазона");
+    for (std::size_t i = 0; i < tree.size(); i += 997) {
+        int key = tree.select(i);
+        const int* bound = frozen.lowerBound(key);
+        assert(bound && *bound == key && "lowerBound не нашёл существующий ключ");
+        assert(frozen.contains(key));
     }
+    assert(frozen.contains(7) && !frozen.contains(-1) && !frozen.lowerBound(numElements * 4));
+    assert(*frozen.lowerBound(-100) == tree.select(0));
 
-    std::cout << "Тест 5 пройден успешно!\n";
+    BTree<std::string> words(3);
+    for (const char* word : {"груша", "яблоко", "слива", "вишня", "абрикос"}) {
+        words.insert(word);
+    }
+    FrozenIndex<std::string> frozenWords = words.freeze();
+    assert(frozenWords.contains(std::string("слива")) && !frozenWords.contains(std::string("персик")));
+    assert(*frozenWords.lowerBound(std::string("в")) == "вишня");
+
+    FrozenIndex<int> empty = BTree<int>(3).freeze();
+    empty.contains(probes, found);
+    assert(empty.size() == 0 && !empty.contains(1) && !found[0]);
+
+    std::cout << "Тест 26 пройден успешно!\n";
 }
 
-void testTreeSizeApproximation() {
-    std::cout << "\n=== Тест 6: Приближенная проверка размера дерева ===" << std::endl;
-    BTree<int> tree(3);
+void testRedistribution() {
+    std::cout << "\n=== Тест 27: Перераспределение перед расщеплением ===" << std::endl;
+    const int numElements = 300000;
 
-    for (int i = 0; i < 500; ++i) {
-        tree.insert(i);
+    BTree<int> plain(8);
+    BTree<int> dense(8);
+    dense.enableRedistribution();
+
+    std::mt19937 rng(45);
+    std::vector<int> keys(numElements);
+    for (int& key : keys) {
+        key = static_cast<int>(rng() % (numElements * 10));
     }
 
-    for (int i = 250; i < 500; ++i) {
-        tree.remove(i);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int key : keys) {
+        plain.insert(key);
     }
+    double plainTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-    for (int i = 0; i < 250; ++i) {
-        assert(tree.search(i) && "Элемент должен быть в дереве");
+    start = std::chrono::high_resolution_clock::now();
+    for (int key : keys) {
+        dense.insert(key);
     }
+    double denseTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-    for (int i = 250; i < 500; ++i) {
-        assert(!tree.search(i) && "Элемент не должен быть в дереве");
+    BTree<int>::Stats plainStats = plain.stats();
+    BTree<int>::Stats denseStats = dense.stats();
+    std::cout << "Обычное расщепление: заполнение " << plainStats.utilization * 100 << "%, узлов " << plainStats.nodes
+              << ", высота " << plainStats.height << ", " << plainTime << " мс" << std::endl;
+    std::cout << "С перераспределением: заполнение " << denseStats.utilization * 100 << "%, узлов " << denseStats.nodes
+              << ", высота " << denseStats.height << ", " << denseTime << " мс" << std::endl;
+
+    assert(denseStats.keys == plainStats.keys && dense.size() == static_cast<std::size_t>(numElements));
+    assert(denseStats.utilization >= 0.66 && "Заполнение узлов должно быть не ниже двух третей");
+    assert(denseStats.utilization > plainStats.utilization && denseStats.nodes < plainStats.nodes);
+    assert(dense.memoryUsage() < plain.memoryUsage() && "Перераспределение должно экономить память");
+
+    std::sort(keys.begin(), keys.end());
+    for (int i = 0; i < numElements; i += 37) {
+        assert(dense.select(i) == keys[i] && "Порядок ключей нарушен после перераспределения");
+    }
+    for (int i = 0; i < numElements; i += 2) {
+        dense.remove(keys[i]);
+    }
+    assert(dense.size() == static_cast<std::size_t>(numElements / 2) && "Неверный размер после удаления");
+    for (int i = 1; i < numElements; i += 50) {
+        assert(dense.search(keys[i]) && "Ключ потерян после удаления");
     }
 
-    std::cout << "Тест 6 пройден успешно!\n";
+    BTree<int> sequentialPlain(8);
+    BTree<int> sequential(8);
+    sequential.enableRedistribution();
+    for (int i = 0; i < 100000; ++i) {
+        sequentialPlain.insert(i);
+        sequential.insert(i);
+    }
+    std::cout << "Последовательная вставка: заполнение " << sequentialPlain.stats().utilization * 100 << "% и "
+              << sequential.stats().utilization * 100 << "%" << std::endl;
+    assert(sequential.stats().utilization >= 0.9 && sequential.stats().utilization >= sequentialPlain.stats().utilization - 0.01);
+    assert(sequential.rank(50000) == 50000);
+
+    std::cout << "Тест 27 пройден успешно!\n";
 }
 
-void testAlternatingInsertRemove() {
-    std::cout << "\n=== Тест 7: Перемешанные вставки и удаления ===" << std::endl;
-    BTree<int> tree(4);
+void testAppendInserts() {
+    std::cout << "\n=== Тест 28: Быстрая вставка в конец ===" << std::endl;
+    const int numElements = 1000000;
 
-    for (int i = 0; i < 10000; i += 2) {
-        tree.insert(i);
+    std::vector<int> shuffled(numElements);
+    for (int i = 0; i < numElements; ++i) {
+        shuffled[i] = i;
+    }
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(46));
+
+    BTree<int> sequential(8);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numElements; ++i) {
+        sequential.insert(i);
+    }
+    double sequentialTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    BTree<int> random(8);
+    start = std::chrono::high_resolution_clock::now();
+    for (int key : shuffled) {
+        random.insert(key);
+    }
+    double randomTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    BTree<int>::Stats sequentialStats = sequential.stats();
+    BTree<int>::Stats randomStats = random.stats();
+    std::cout << "Последовательная вставка: " << sequentialTime << " мс, заполнение " << sequentialStats.utilization * 100
+              << "%, высота " << sequentialStats.height << std::endl;
+    std::cout << "Случайная вставка: " << randomTime << " мс, заполнение " << randomStats.utilization * 100
+              << "%, высота " << randomStats.height << std::endl;
+
+    assert(sequential.size() == static_cast<std::size_t>(numElements));
+    assert(sequentialStats.utilization >= 0.9 && "Последовательная вставка должна давать почти полные узлы");
+    for (int i = 0; i < numElements; i += 101) {
+        assert(sequential.select(i) == i && sequential.search(i) && "Ключ потерян при вставке в конец");
+    }
+    sequential.insert(-1);
+    assert(sequential.stats().underfull == 0 && "Правый край должен быть дозаполнен после серии вставок в конец");
+    sequential.remove(-1);
+
+    BTree<int> mixed(3);
+    std::vector<int> reference;
+    std::mt19937 rng(47);
+    int next = 0;
+    for (int i = 0; i < 50000; ++i) {
+        int key = rng() % 4 == 0 ? static_cast<int>(rng() % (next + 1)) : next++;
+        mixed.insert(key);
+        reference.push_back(key);
+        if (i % 5 == 0) {
+            mixed.insert(key);
+            reference.push_back(key);
+        }
+        if (i % 7 == 0) {
+            int victim = reference[rng() % reference.size()];
+            mixed.remove(victim);
+            reference.erase(std::find(reference.begin(), reference.end(), victim));
+        }
+        if (i % 700 == 0) {
+            assert(mixed.stats().underfull == 0 && "Недозаполненный узел при смешанной нагрузке");
+        }
+    }
+    std::sort(reference.begin(), reference.end());
+    assert(mixed.size() == reference.size() && "Неверный размер при смешанной нагрузке");
+    for (std::size_t i = 0; i < reference.size(); i += 11) {
+        assert(mixed.select(i) == reference[i] && "Порядок ключей нарушен при смешанной нагрузке");
     }
 
-    for (int i = 0; i < 10000; ++i) {
-        if (i % 4 == 0) {
-            tree.remove(i);
-        } else if (i % 2 == 0) {
-            assert(tree.search(i) && "Элемент должен быть найден после вставки");
-        }
+    for (int i = 0; i < numElements; i += 2) {
+        sequential.remove(i);
     }
+    for (int i = numElements; i < numElements + 1000; ++i) {
+        sequential.insert(i);
+    }
+    assert(sequential.size() == static_cast<std::size_t>(numElements / 2 + 1000));
+    assert(sequential.select(numElements / 2) == numElements && sequential.rank(numElements + 999) == static_cast<std::size_t>(numElements / 2 + 999));
+    assert(sequential.pop_max() == numElements + 999 && sequential.stats().underfull == 0);
 
-    for (int i = 0; i < 10000; ++i) {
-        if (i % 4 == 0) {
-            assert(!tree.search(i) && "Элемент не должен быть найден после удаления");
-        }
+    BTree<int> head(4);
+    BTree<int> tail(4);
+    for (int i = 0; i < 20000; ++i) {
+        head.insert(i);
+        tail.insert(20000 + i);
     }
+    head.join(tail);
+    assert(head.size() == 40000 && head.select(25000) == 25000 && head.stats().underfull == 0 && "Недозаполненный узел после join");
+    BTree<int> rest(4);
+    head.split(30000, rest);
+    assert(head.stats().underfull == 0 && rest.stats().underfull == 0 && rest.min() == 30000 && "Недозаполненный узел после split");
 
-    std::cout << "Тест 7 пройден успешно!\n";
+    std::cout << "Тест 28 пройден успешно!\n";
 }
 
-void testConcurrencyMixed() {
-    std::cout << "\n=== Тест 8: Смешанная многопоточность (вставка и удаление одновременно) ===" << std::endl;
-
-    BTree<int> tree(3);
-    const int numThreads = 4;
-    const int numElements = 1000;
+void testPriorityQueue() {
+    std::cout << "\n=== Тест 29: Очередь с приоритетом ===" << std::endl;
+    const int numElements = 200000;
 
-    auto insertFunc = [&tree](int start) {
-        for (int i = start; i < start + numElements; ++i) {
-            tree.insert(i);
-        }
-    };
+    BTree<int> tree(8);
+    assert(!tree.min() && !tree.max() && !tree.pop_min() && !tree.pop_max() && "Пустое дерево не должно иметь минимума");
 
-    auto removeFunc = [&tree](int start) {
-        for (int i = start; i < start + numElements; ++i) {
-            tree.remove(i);
-        }
-    };
+    std::mt19937 rng(47);
+    std::vector<int> keys(numElements);
+    for (int& key : keys) {
+        key = static_cast<int>(rng() % (numElements * 4));
+        tree.insert(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    assert(*tree.min() == keys.front() && *tree.max() == keys.back() && "Неверные min/max");
 
-    std::vector<std::thread> threads;
+    BTree<int> baseline(8);
+    for (int key : keys) {
+        baseline.insert(key);
+    }
 
-    for (int i = 0; i < numThreads; ++i) {
-        if (i % 2 == 0) {
-            threads.emplace_back(insertFunc, i * numElements);
-        } else {
-            threads.emplace_back(removeFunc, (i - 1) * numElements); 
-        }
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numElements / 2; ++i) {
+        std::optional<int> key = tree.pop_min();
+        assert(key && *key == keys[i] && "pop_min вернул не минимальный ключ");
     }
+    double popTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-    for (auto& t : threads) {
-        t.join();
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numElements / 2; ++i) {
+        int key = baseline.select(0);
+        baseline.remove(key);
     }
+    double selectTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "pop_min: " << popTime << " мс, select(0) + remove: " << selectTime << " мс" << std::endl;
 
-    int insertedElements = (numThreads / 2) * numElements;
-    int foundElements = 0;
-    for (int i = 0; i < insertedElements * 2; ++i) {
-        bool found = tree.search(i);
-        if (found) {
-            foundElements++;
-            if (i % 2 == 1) {
-                assert(found && "Элемент должен быть найден после вставки нечетного потоком");
-            }
-        } else {
-            if (i % 2 == 0 && i < insertedElements) {
-                assert(!found && "Элемент не должен быть найден после удаления четного потоком");
-            }
-        }
+    for (int i = numElements - 1; i >= numElements / 2 + 1000; --i) {
+        assert(*tree.max() == keys[i] && *tree.pop_max() == keys[i] && "pop_max вернул не максимальный ключ");
     }
-    
-    std::cout << "Найдено элементов: " << foundElements << std::endl;
-    std::cout << "Тест 8 пройден успешно!\n";
-}
+    assert(tree.size() == 1000 && *tree.min() == keys[numElements / 2] && *tree.max() == keys[numElements / 2 + 999]);
 
-void testHeavyConcurrency() {
-    std::cout << "\n=== Тест 9: Финальный стресс-тест ===" << std::endl;
-    BTree<int> tree(4);
-    const int numThreads = 16;
-    const int operationsPerThread = 50000;
-    const int keyRange = 100000;
+    tree.insert(-1);
+    tree.insert(numElements * 8);
+    assert(*tree.min() == -1 && *tree.max() == numElements * 8 && "min/max не обновились после вставки");
+    tree.remove(-1);
+    assert(*tree.min() == keys[numElements / 2] && "min не обновился после удаления");
 
-    std::atomic<bool> running{true};
-    std::atomic<int> insertCount{0};
-    std::atomic<int> removeCount{0};
+    BTree<int> queue(4);
+    const int numProducers = 4;
+    const int numConsumers = 4;
+    const int perProducer = 20000;
+    std::atomic<int> consumed(0);
+    std::atomic<long long> producedSum(0);
+    std::atomic<long long> consumedSum(0);
 
     std::vector<std::thread> threads;
-    std::atomic<int>* keyCounters = new std::atomic<int>[keyRange + 1]();
-
-    auto worker = [&](int id) {
-        std::mt19937 rng(std::random_device{}() + id);
-        std::uniform_int_distribution<int> opDist(0, 1);
-        std::uniform_int_distribution<int> keyDist(0, keyRange);
-    
-        for (int i = 0; i < operationsPerThread; ++i) {
-            int op = opDist(rng);
-            int key = keyDist(rng);
-    
-            if (op == 0) {
-                tree.insert(key);
-                keyCounters[key].fetch_add(1, std::memory_order_relaxed);
-                insertCount.fetch_add(1, std::memory_order_relaxed);
-            } else {
-                int expected = keyCounters[key].load(std::memory_order_relaxed);
-                if (expected > 0) {
-                    bool success = false;
-                    while (expected > 0 && !success) {
-                        success = keyCounters[key].compare_exchange_weak(
-                            expected, expected - 1,
-                            std::memory_order_release,
-                            std::memory_order_relaxed);
-                        if (success) {
-                            tree.remove(key);
-                            removeCount.fetch_add(1, std::memory_order_relaxed);
-                        } else {
-                            expected = keyCounters[key].load(std::memory_order_relaxed);
-                        }
-                    }
+    for (int i = 0; i < numProducers; ++i) {
+        threads.emplace_back([&queue, &producedSum, i]() {
+            std::mt19937 local(i);
+            for (int j = 0; j < perProducer; ++j) {
+                int priority = static_cast<int>(local() % 100000);
+                queue.insert(priority);
+                producedSum += priority;
+            }
+        });
+    }
+    for (int i = 0; i < numConsumers; ++i) {
+        threads.emplace_back([&queue, &consumed, &consumedSum]() {
+            while (consumed.load() < numProducers * perProducer) {
+                if (std::optional<int> priority = queue.pop_min()) {
+                    consumedSum += *priority;
+                    consumed++;
+                } else {
+                    std::this_thread::yield();
                 }
             }
-        }
-    };
-
-    for (int i = 0; i < numThreads; ++i) {
-        threads.emplace_back(worker, i);
+        });
     }
-
     for (auto& t : threads) {
         t.join();
     }
+    assert(consumed.load() == numProducers * perProducer && queue.size() == 0 && "Не все элементы извлечены");
+    assert(consumedSum.load() == producedSum.load() && "Извлечённые приоритеты не совпадают с вставленными");
 
-    std::cout << "Все потоки завершены. Проверка целостности дерева..." << std::endl;
-    std::cout << "Вставлено ключей: " << insertCount.load() << std::endl;
-    std::cout << "Удалено ключей: " << removeCount.load() << std::endl;
-
-    std::unordered_set<int> finalExpectedKeys;
-    for (int key = 0; key <= keyRange; ++key) {
-        int count = keyCounters[key].load(std::memory_order_relaxed);
-        if (count > 0) {
-            finalExpectedKeys.insert(key);
-        }
-    }
+    std::cout << "Тест 29 пройден успешно!\n";
+}
 
-    int foundCount = 0;
-    int discrepancies = 0;
-    std::vector<int> missingKeys;
-    std::vector<int> extraKeys;
+void testBufferPool() {
+    std::cout << "\n=== Тест 30: Индекс больше памяти ===" << std::endl;
+    char path[] = "/tmp/btree_buffered_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0 && "Не удалось создать временный файл");
+    close(fd);
 
-    for (int key = 0; key <= keyRange; ++key) {
-        bool expected = finalExpectedKeys.count(key) > 0;
-        bool actual = tree.search(key);
+    const int numKeys = 30000;
+    const std::size_t cachePages = 64;
+    std::vector<int> order(numKeys);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937(48));
 
-        if (expected != actual) {
-            if (discrepancies < 10) {
-                std::cerr << "Mismatch for key " << key << ": Expected="
-                          << expected << ", Actual=" << actual 
-                          << ", Counter=" << keyCounters[key].load() << std::endl;
-                if (expected && !actual) missingKeys.push_back(key);
-                if (!expected && actual) extraKeys.push_back(key);
-            }
-            discrepancies++;
+    {
+        MappedBTree<int> tree(path, 16, cachePages);
+        auto start = std::chrono::steady_clock::now();
+        for (int key : order) {
+            tree.insert(key * 3);
+        }
+        for (int i = 0; i < numKeys; i += 5) {
+            tree.remove(i * 3);
         }
+        double writeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        assert(tree.size() == static_cast<std::size_t>(numKeys - numKeys / 5) && "Неверный размер индекса");
 
-        if (actual) {
-            foundCount++;
+        for (int i = 0; i < numKeys; i += 7) {
+            assert(tree.search(i * 3) == (i % 5 != 0) && "Ключ потерян при вытеснении страниц");
+            assert(!tree.search(i * 3 + 1) && "Найден отсутствующий ключ");
         }
+
+        start = std::chrono::steady_clock::now();
+        std::size_t visited = 0;
+        int previous = -1;
+        tree.forEach([&](int key) {
+            assert(key > previous && "Нарушен порядок обхода");
+            previous = key;
+            ++visited;
+        });
+        double scanTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        assert(visited == tree.size() && "Обход посетил не все ключи");
+
+        struct stat st;
+        stat(path, &st);
+        assert(static_cast<std::size_t>(st.st_size) > 10 * cachePages * MappedPool::PAGE_SIZE && "Файл должен превышать пул");
+        std::cout << "Файл: " << st.st_size / 1024 << " КБ, пул: " << cachePages * MappedPool::PAGE_SIZE / 1024
+                  << " КБ, промахов: " << tree.cacheMisses() << std::endl;
+        std::cout << "Запись: " << writeTime << " мс, обход: " << scanTime << " мс" << std::endl;
     }
 
-    if (discrepancies > 0) {
-        std::cerr << "ОШИБКА: Обнаружено " << discrepancies << " несоответствий!" << std::endl;
-        if (!missingKeys.empty()) {
-            std::cerr << "Примеры отсутствующих ключей: ";
-            for (size_t i = 0; i < std::min(missingKeys.size(), (size_t)5); ++i) {
-                std::cerr << missingKeys[i] << " ";
-            }
-            std::cerr << std::endl;
+    {
+        MappedBTree<int> tree(path, 0, cachePages);
+        assert(tree.size() == static_cast<std::size_t>(numKeys - numKeys / 5) && "Размер не сохранился");
+        for (int i = 0; i < numKeys; i += 3) {
+            assert(tree.search(i * 3) == (i % 5 != 0) && "Ключ не сохранился после переоткрытия");
         }
-        if (!extraKeys.empty()) {
-            std::cerr << "Примеры лишних ключей: ";
-            for (size_t i = 0; i < std::min(extraKeys.size(), (size_t)5); ++i) {
-                std::cerr << extraKeys[i] << " ";
-            }
-            std::cerr << std::endl;
+        for (int i = 0; i < numKeys; i += 5) {
+            tree.insert(i * 3);
         }
-        assert(discrepancies == 0 && "Несоответствие наличия ключа после стресс-теста!");
-    } else {
-        std::cout << "Проверка целостности дерева прошла успешно: несоответствий не обнаружено!" << std::endl;
-        std::cout << "Финальный стресс-тест успешно пройден!" << std::endl;
     }
-    std::cout << "Найдено элементов в дереве: " << foundCount << "\n";
 
-    delete[] keyCounters;
+    {
+        MappedBTree<int> tree(path);
+        assert(tree.size() == static_cast<std::size_t>(numKeys) && "Файл буферного режима не читается через mmap");
+        for (int i = 0; i < numKeys; i += 11) {
+            assert(tree.search(i * 3) && "Ключ не найден при открытии через mmap");
+        }
+    }
+
+    unlink(path);
+    std::cout << "Тест 30 пройден успешно!\n";
 }
 
-void testHeavyConcurrencyString() {
-    std::cout << "\n=== Тест 10: Финальный стресс-тест(строки) ===" << std::endl;
-    BTree<std::string> tree(4);
-    const int numThreads = 16;
-    const int operationsPerThread = 50000;
-    const int keyRange = 100000;
+void testParallelTraversal() {
+    std::cout << "\n=== Тест 31: Параллельный обход ===" << std::endl;
+    const int numElements = 2000000;
 
-    std::atomic<bool> running{true};
-    std::atomic<int> insertCount{0};
-    std::atomic<int> removeCount{0};
+    BTree<int> tree(16);
+    for (int i = 0; i < numElements; ++i) {
+        tree.insert(i);
+    }
 
-    std::vector<std::thread> threads;
-    std::atomic<int>* keyCounters = new std::atomic<int>[keyRange + 1]();
+    auto start = std::chrono::high_resolution_clock::now();
+    std::atomic<long long> visited{0};
+    tree.parallel_for_each([&visited](int key) {
+        visited.fetch_add(key, std::memory_order_relaxed);
+    });
+    double forEachTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    long long expected = static_cast<long long>(numElements) * (numElements - 1) / 2;
+    assert(visited.load() == expected && "parallel_for_each посетил не все ключи");
 
-    auto worker = [&](int id) {
-        std::mt19937 rng(std::random_device{}() + id);
-        std::uniform_int_distribution<int> opDist(0, 1);
-        std::uniform_int_distribution<int> keyDist(0, keyRange);
-    
-        for (int i = 0; i < operationsPerThread; ++i) {
-            int op = opDist(rng);
-            std::string key = "key_" + std::to_string(keyDist(rng));
-            int keyIndex = std::stoi(key.substr(4));
-    
-            if (op == 0) {
-                tree.insert(key);
-                keyCounters[keyIndex].fetch_add(1, std::memory_order_relaxed);
-                insertCount.fetch_add(1, std::memory_order_relaxed);
-            } else {
-                int expected = keyCounters[keyIndex].load(std::memory_order_relaxed);
-                if (expected > 0) {
-                    bool success = false;
-                    while (expected > 0 && !success) {
-                        success = keyCounters[keyIndex].compare_exchange_weak(
-                            expected, expected - 1,
-                            std::memory_order_release,
-                            std::memory_order_relaxed);
-                        if (success) {
-                            tree.remove(key);
-                            removeCount.fetch_add(1, std::memory_order_relaxed);
-                        } else {
-                            expected = keyCounters[keyIndex].load(std::memory_order_relaxed);
-                        }
-                    }
-                }
-            }
-        }
-    };
+    start = std::chrono::high_resolution_clock::now();
+    long long sum = tree.parallel_reduce(0LL, [](long long acc, int key) { return acc + key; },
+                                         [](long long a, long long b) { return a + b; });
+    double reduceTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    assert(sum == expected && "Неверная сумма parallel_reduce");
+    std::cout << "Потоков в пуле: " << WorkStealingPool::instance().concurrency() << ", parallel_for_each: " << forEachTime
+              << " мс, parallel_reduce: " << reduceTime << " мс" << std::endl;
 
-    for (int i = 0; i < numThreads; ++i) {
-        threads.emplace_back(worker, i);
+    std::vector<int> exported = tree.parallel_reduce(
+        std::vector<int>(),
+        [](std::vector<int> acc, int key) {
+            acc.push_back(key);
+            return acc;
+        },
+        [](std::vector<int> a, std::vector<int> b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+        });
+    assert(exported.size() == static_cast<std::size_t>(numElements) && "Экспорт потерял ключи");
+    assert(std::is_sorted(exported.begin(), exported.end()) && "parallel_reduce нарушил порядок ключей");
+
+    bool thrown = false;
+    try {
+        tree.parallel_for_each([](int key) {
+            if (key == numElements / 3) throw std::runtime_error("stop");
+        });
+    } catch (const std::runtime_error&) {
+        thrown = true;
     }
+    assert(thrown && "Исключение из задачи должно доходить до вызывающего");
 
-    for (auto& t : threads) {
-        t.join();
+    BTree<int> lazy(3);
+    for (int i = 0; i < 10000; ++i) {
+        lazy.insert(i);
     }
+    lazy.enableLazyDelete();
+    for (int i = 0; i < 10000; i += 2) {
+        lazy.remove(i);
+    }
+    std::size_t odd = lazy.parallel_reduce(std::size_t(0), [](std::size_t acc, int key) { return acc + (key % 2); },
+                                           [](std::size_t a, std::size_t b) { return a + b; });
+    assert(odd == 5000 && lazy.size() == 5000 && "Удалённые ключи видны при параллельном обходе");
 
-    std::cout << "Все потоки завершены. Проверка целостности дерева..." << std::endl;
-    std::cout << "Вставлено ключей: " << insertCount.load() << std::endl;
-    std::cout << "Удалено ключей: " << removeCount.load() << std::endl;
+    BTree<int> empty(4);
+    assert(empty.parallel_reduce(7, [](int acc, int) { return acc + 1; }, [](int a, int b) { return a + b; }) == 7);
 
-    std::unordered_set<int> finalExpectedKeys;
-    for (int key = 0; key <= keyRange; ++key) {
-        int count = keyCounters[key].load(std::memory_order_relaxed);
-        if (count > 0) {
-            finalExpectedKeys.insert(key);
-        }
+    std::cout << "Тест 31 пройден успешно!\n";
+}
+
+void testMultiSearch() {
+    std::cout << "\n=== Тест 32: Пакетный поиск ===" << std::endl;
+    const int numElements = 1000000;
+    const int numProbes = 1000000;
+
+    BTree<int> tree(8);
+    std::mt19937 rng(50);
+    for (int i = 0; i < numElements; ++i) {
+        tree.insert(static_cast<int>(rng() % (2 * numElements)));
     }
 
-    int foundCount = 0;
-    int discrepancies = 0;
-    std::vector<std::string> missingKeys;
-    std::vector<std::string> extraKeys;
+    std::vector<int> probes(numProbes);
+    for (int& probe : probes) {
+        probe = static_cast<int>(rng() % (2 * numElements + 100)) - 50;
+    }
 
-    for (int key = 0; key <= keyRange; ++key) {
-        std::string keyStr = "key_" + std::to_string(key);
-        bool expected = finalExpectedKeys.count(key) > 0;
-        bool actual = tree.search(keyStr);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<bool> single(numProbes);
+    for (int i = 0; i < numProbes; ++i) {
+        single[i] = tree.search(probes[i]);
+    }
+    double singleTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-        if (expected != actual) {
-            if (discrepancies < 10) {
-                std::cerr << "Mismatch for key " << keyStr << ": Expected="
-                          << expected << ", Actual=" << actual 
-                          << ", Counter=" << keyCounters[key].load() << std::endl;
-                if (expected && !actual) missingKeys.push_back(keyStr);
-                if (!expected && actual) extraKeys.push_back(keyStr);
-            }
-            discrepancies++;
-        }
+    start = std::chrono::high_resolution_clock::now();
+    std::vector<bool> batched;
+    tree.multiSearch(probes, batched);
+    double batchTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Поштучный поиск: " << singleTime << " мс, multiSearch: " << batchTime << " мс" << std::endl;
+    assert(batched == single && "multiSearch расходится с search");
 
-        if (actual) {
-            foundCount++;
-        }
+    std::sort(probes.begin(), probes.end());
+    start = std::chrono::high_resolution_clock::now();
+    tree.multiSearch(probes, batched);
+    batchTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "multiSearch по отсортированным ключам: " << batchTime << " мс" << std::endl;
+    for (int i = 0; i < numProbes; i += 13) {
+        assert(batched[i] == tree.search(probes[i]) && "multiSearch ошибся на отсортированных ключах");
     }
 
-    if (discrepancies > 0) {
-        std::cerr << "ОШИБКА: Обнаружено " << discrepancies << " несоответствий!" << std::endl;
-        if (!missingKeys.empty()) {
-            std::cerr << "Примеры отсутствующих ключей: ";
-            for (size_t i = 0; i < std::min(missingKeys.size(), (size_t)5); ++i) {
-                std::cerr << missingKeys[i] << " ";
-            }
-            std::cerr << std::endl;
+    for (int degree = 2; degree <= 4; ++degree) {
+        BTree<int> small(degree);
+        for (int i = 0; i < 3000; ++i) {
+            small.insert(i % 1000 * 2);
         }
-        if (!extraKeys.empty()) {
-            std::cerr << "Примеры лишних ключей: ";
-            for (size_t i = 0; i < std::min(extraKeys.size(), (size_t)5); ++i) {
-                std::cerr << extraKeys[i] << " ";
-            }
-            std::cerr << std::endl;
+        small.enableLazyDelete();
+        for (int i = 0; i < 2000; i += 6) {
+            small.remove(i);
+        }
+        std::vector<int> keys;
+        for (int i = 2100; i >= -100; --i) {
+            keys.push_back(i);
+            keys.push_back(i / 3 * 3);
+        }
+        small.multiSearch(keys, batched);
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            assert(batched[i] == small.search(keys[i]) && "multiSearch ошибся на дубликатах или надгробиях");
         }
-        assert(discrepancies == 0 && "Несоответствие наличия ключа после стресс-теста!");
-    } else {
-        std::cout << "Проверка целостности дерева прошла успешно: несоответствий не обнаружено!" << std::endl;
-        std::cout << "Финальный стресс-тест успешно пройден!" << std::endl;
     }
-    std::cout << "Найдено элементов в дереве: " << foundCount << "\n";
 
-    delete[] keyCounters;
-}
\ No newline at end of file
+    BTree<std::string> strings(3);
+    for (int i = 0; i < 5000; ++i) {
+        strings.insert("key_" + std::to_string(i));
+    }
+    std::vector<std::string_view> views{"key_42", "key_4999", "key_5000", "key_", "zzz"};
+    strings.multiSearch(views, batched);
+    assert(batched == std::vector<bool>({true, true, false, false, false}) && "multiSearch по string_view");
+
+    BTree<int> empty(4);
+    empty.multiSearch(std::vector<int>{1, 2, 3}, batched);
+    assert(batched.size() == 3 && !batched[0] && !batched[1] && !batched[2]);
+
+    std::cout << "Тест 32 пройден успешно!\n";
+}